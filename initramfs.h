@@ -0,0 +1,34 @@
+// initramfs.h - Boot archive format (shared by kernel and mkinitramfs)
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+#include <stdint.h>
+
+// The archive is linked into kernel.elf (section .initramfs) and used in
+// place: a header, an index of entries sorted by name for binary search,
+// then each file's data starting on its own page so it can be mapped
+// directly.
+//
+//   header | entry[count] | pad | file 0 | pad | file 1 | ...
+
+#define INITRAMFS_MAGIC    0x44525449  // "ITRD"
+#define INITRAMFS_VERSION  1
+#define INITRAMFS_ALIGN    4096
+#define INITRAMFS_NAME_MAX 47
+
+struct initramfs_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;            // Entries in the index
+    uint32_t size;             // Total archive bytes
+};
+
+struct initramfs_entry {
+    char name[INITRAMFS_NAME_MAX + 1];
+    uint32_t offset;           // From the archive start, INITRAMFS_ALIGN-aligned
+    uint32_t size;             // Bytes
+    uint32_t mode;             // Host permission bits (0755 for executables)
+    uint32_t reserved;
+};
+
+#endif // INITRAMFS_H
@@ -1,96 +1,35 @@
 // kernel.c - Main kernel code with simple shell
+#include "klib.h"
 #include "sbi.h"
-
-// Simple string functions
-long strlen(const char* str) {
-    long len = 0;
-    while (str[len]) len++;
-    return len;
-}
-
-int strcmp(const char* s1, const char* s2) {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-    }
-    return *(unsigned char*)s1 - *(unsigned char*)s2;
-}
-
-int strncmp(const char* s1, const char* s2, long n) {
-    while (n && *s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-        n--;
-    }
-    if (n == 0) return 0;
-    return *(unsigned char*)s1 - *(unsigned char*)s2;
-}
-
-void strcpy(char* dst, const char* src) {
-    while (*src) {
-        *dst++ = *src++;
-    }
-    *dst = '\0';
-}
-
-void strncpy(char* dst, const char* src, long n) {
-    while (n && *src) {
-        *dst++ = *src++;
-        n--;
-    }
-    if (n > 0) *dst = '\0';
-}
-
-// Character classification functions (handle unsigned char properly)
-int isdigit(int c) {
-    return c >= '0' && c <= '9';
-}
-
-int isalpha(int c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
-}
-
-int isalnum(int c) {
-    return isalpha(c) || isdigit(c);
-}
-
-int isspace(int c) {
-    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
-}
-
-int isupper(int c) {
-    return c >= 'A' && c <= 'Z';
-}
-
-int islower(int c) {
-    return c >= 'a' && c <= 'z';
-}
-
-// Character conversion functions
-int toupper(int c) {
-    if (c >= 'a' && c <= 'z') {
-        return c - 32;
-    }
-    return c;
-}
-
-int tolower(int c) {
-    if (c >= 'A' && c <= 'Z') {
-        return c + 32;
-    }
-    return c;
-}
+#include "virtio.h"
+#include "vibefs.h"
+#include "initramfs.h"
+#include "syscall.h"
+#include "ulock.h"
 
 // Console I/O functions
 void putchar(char c) {
     sbi_console_putchar(c);
 }
 
+// Console write: one SBI call per buffer when the debug console extension
+// exists (probed on first use), else one call per character
+int console_dbcn = -1;
+
+void console_write(const char* s, long len) {
+    if (console_dbcn < 0) console_dbcn = sbi_probe_extension(SBI_EXT_DBCN) != 0;
+    while (console_dbcn && len > 0) {
+        long n = sbi_debug_console_write(s, len);
+        if (n <= 0) break;
+        s += n;
+        len -= n;
+    }
+    while (len-- > 0) sbi_console_putchar(*s++);
+}
+
 // puts - print string WITHOUT adding newline
 void puts(const char* str) {
-    while (*str) {
-        putchar(*str++);
-    }
+    console_write(str, strlen(str));
 }
 
 // puts_ln - print string WITH newline
@@ -99,143 +38,18 @@ void puts_ln(const char* str) {
     putchar('\n');
 }
 
+// Let kernel threads run while waiting for input (defined with the scheduler)
+void kthread_yield(void);
+
 int getchar(void) {
     int c;
     while ((c = sbi_console_getchar()) == -1) {
-        // Busy wait for character
+        // Busy wait for character, letting kernel threads run meanwhile
+        kthread_yield();
     }
     return c;
 }
 
-// Memset - fill memory with value
-void memset(void* ptr, int value, long size) {
-    unsigned char* p = (unsigned char*)ptr;
-    for (long i = 0; i < size; i++) {
-        p[i] = (unsigned char)value;
-    }
-}
-
-// Internal function for number to string conversion
-void int_to_str(long num, char* str, int base) {
-    char digits[] = "0123456789abcdef";
-    char buffer[32];
-    int i = 0;
-    
-    if (num == 0) {
-        str[0] = '0';
-        str[1] = '\0';
-        return;
-    }
-    
-    // Only emit a leading '-' for base-10.
-    // For hex (%x) and other bases, mimic typical printf behavior by treating the
-    // value as unsigned (two's complement representation for negatives).
-    int sign = (base == 10 && num < 0) ? 1 : 0;
-    unsigned long unum = sign ? (unsigned long)(-(unsigned long)num) : (unsigned long)num;
-    
-    while (unum > 0) {
-        buffer[i++] = digits[unum % (unsigned long)base];
-        unum /= (unsigned long)base;
-    }
-    
-    if (sign) str[0] = '-';
-    int j = 0;
-    while (i > 0) {
-        str[j + sign] = buffer[--i];
-        j++;
-    }
-    str[j + sign] = '\0';
-}
-
-// vsprintf implementation - uses variadic args directly
-void simple_sprintf(char* buf, int buf_size, const char* fmt, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6) {
-    int buf_idx = 0;
-    int arg_idx = 0;
-    long args[6] = {arg1, arg2, arg3, arg4, arg5, arg6};
-    
-    while (*fmt && buf_idx < buf_size - 1) {
-        if (*fmt == '%' && *(fmt + 1)) {
-            fmt++;
-            switch (*fmt) {
-                case 'd': {
-                    if (arg_idx >= 6) break;
-                    long num = args[arg_idx++];
-                    char num_str[32];
-                    int_to_str(num, num_str, 10);
-                    int i = 0;
-                    while (num_str[i] && buf_idx < buf_size - 1) {
-                        buf[buf_idx++] = num_str[i++];
-                    }
-                    break;
-                }
-                case 'x': {
-                    if (arg_idx >= 6) break;
-                    long num = args[arg_idx++];
-                    char hex_str[16];
-                    int_to_str(num, hex_str, 16);
-                    int i = 0;
-                    while (hex_str[i] && buf_idx < buf_size - 1) {
-                        buf[buf_idx++] = hex_str[i++];
-                    }
-                    break;
-                }
-                case 's': {
-                    if (arg_idx >= 6) break;
-                    char* str = (char*)args[arg_idx++];
-                    if (str) {
-                        while (*str && buf_idx < buf_size - 1) {
-                            buf[buf_idx++] = *str++;
-                        }
-                    }
-                    break;
-                }
-                case 'c': {
-                    if (arg_idx >= 6) break;
-                    if (buf_idx < buf_size - 1) {
-                        buf[buf_idx++] = (char)args[arg_idx++];
-                    }
-                    break;
-                }
-                case '%': {
-                    if (buf_idx < buf_size - 1) {
-                        buf[buf_idx++] = '%';
-                    }
-                    break;
-                }
-                default:
-                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '%';
-                    if (buf_idx < buf_size - 1) buf[buf_idx++] = *fmt;
-                    break;
-            }
-        } else if (*fmt == '\\' && *(fmt + 1)) {
-            fmt++;
-            switch (*fmt) {
-                case 'n':
-                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\n';
-                    break;
-                case 'r':
-                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\r';
-                    break;
-                case 't':
-                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\t';
-                    break;
-                case '\\':
-                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\\';
-                    break;
-                default:
-                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\\';
-                    if (buf_idx < buf_size - 1) buf[buf_idx++] = *fmt;
-                    break;
-            }
-        } else {
-            if (buf_idx < buf_size - 1) buf[buf_idx++] = *fmt;
-        }
-        fmt++;
-    }
-    buf[buf_idx] = '\0';
-}
-
-
 // printf - formatted console output (simplified for up to 6 args)
 void printf(const char* fmt, long a1, long a2, long a3, long a4, long a5, long a6) {
     char buf[512];
@@ -245,112 +59,6 @@ void printf(const char* fmt, long a1, long a2, long a3, long a4, long a5, long a
 
 // Phase 2: Keyboard & Input Handling
 
-// Input buffer for circular queue
-#define INPUT_BUFFER_SIZE 256
-char input_buffer[INPUT_BUFFER_SIZE];
-int input_head = 0;
-int input_tail = 0;
-int input_count = 0;
-
-// PS/2 key code to ASCII translation table (US layout)
-char keycode_to_ascii[128] = {
-    0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', 8, 9,
-    'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', 13, 0, 'a', 's',
-    'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0, '\\', 'z', 'x', 'c', 'v',
-    'b', 'n', 'm', ',', '.', '/', 0, '*', 0, ' ', 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '-', 0, 0, 0, '+', 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-};
-
-// Shifted key codes
-char keycode_to_ascii_shift[128] = {
-    0, 27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', 8, 9,
-    'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', 13, 0, 'A', 'S',
-    'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~', 0, '|', 'Z', 'X', 'C', 'V',
-    'B', 'N', 'M', '<', '>', '?', 0, '*', 0, ' ', 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '-', 0, 0, 0, '+', 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-};
-
-int shift_pressed = 0;
-int ctrl_pressed = 0;
-int alt_pressed = 0;
-
-// Input buffer management
-void input_buffer_put(char c) {
-    if (input_count < INPUT_BUFFER_SIZE) {
-        input_buffer[input_tail] = c;
-        input_tail = (input_tail + 1) % INPUT_BUFFER_SIZE;
-        input_count++;
-    }
-}
-
-int input_buffer_get(void) {
-    if (input_count > 0) {
-        unsigned char c = (unsigned char)input_buffer[input_head];
-        input_head = (input_head + 1) % INPUT_BUFFER_SIZE;
-        input_count--;
-        return (int)c;
-    }
-    return -1;  // EOF
-}
-
-int input_buffer_empty(void) {
-    return input_count == 0;
-}
-
-// PS/2 keyboard handler
-void keyboard_handler(int keycode) {
-    int key_released = keycode & 0x80;
-    keycode = keycode & 0x7F;
-    
-    if (key_released) {
-        // Handle key release
-        if (keycode == 0x2A || keycode == 0x36) {  // Left/Right Shift
-            shift_pressed = 0;
-        } else if (keycode == 0x1D) {  // Left Ctrl
-            ctrl_pressed = 0;
-        } else if (keycode == 0x38) {  // Left Alt
-            alt_pressed = 0;
-        }
-    } else {
-        // Handle key press
-        switch (keycode) {
-            case 0x2A:
-            case 0x36:  // Left/Right Shift
-                shift_pressed = 1;
-                break;
-            case 0x1D:  // Left Ctrl
-                ctrl_pressed = 1;
-                break;
-            case 0x38:  // Left Alt
-                alt_pressed = 1;
-                break;
-            case 0x53:  // Delete (Ctrl+D)
-                if (ctrl_pressed) {
-                    input_buffer_put(4);  // Ctrl+D = ASCII 4
-                }
-                break;
-            default:
-                if (keycode < 128) {
-                    char c = shift_pressed ? keycode_to_ascii_shift[keycode] : keycode_to_ascii[keycode];
-                    if (c != 0) {
-                        if (ctrl_pressed && (c >= 'a' && c <= 'z')) {
-                            input_buffer_put((char)(c - 'a' + 1));  // Ctrl+A=1, Ctrl+C=3, etc.
-                        } else {
-                            input_buffer_put(c);
-                        }
-                    }
-                }
-                break;
-        }
-    }
-}
-
 // Read a line from console with keyboard input buffering
 void readline(char* buf, int max_len) {
     int pos = 0;
@@ -398,97 +106,153 @@ void readline(char* buf, int max_len) {
 #define HEAP_SIZE (1024 * 1024)  // 1MB
 #define HEAP_END (HEAP_START + HEAP_SIZE)
 
-// Simple bump allocator with free list
-static char* heap_ptr = (char*)HEAP_START;
-static char* heap_end = (char*)HEAP_END;
-
-// Memory statistics - using global variables for proper initialization
-long mem_total_allocated = 0;
-long mem_total_freed = 0;
-long mem_current_usage = 0;
-long mem_peak_usage = 0;
-long mem_num_allocations = 0;
-long mem_num_frees = 0;
-
 // Initialize memory management
 void mem_init(void) {
-    heap_ptr = (char*)HEAP_START;
-    
-    // Global variables are automatically zeroed, but be explicit
-    mem_total_allocated = 0;
-    mem_total_freed = 0;
-    mem_current_usage = 0;
-    mem_peak_usage = 0;
-    mem_num_allocations = 0;
-    mem_num_frees = 0;
+    heap_init((void*)HEAP_START, HEAP_SIZE);
 }
 
-// Simple malloc implementation (bump allocator)
-void* malloc(long size) {
-    if (size <= 0 || heap_ptr + size > heap_end) {
-        return 0;  // NULL - out of memory
+// Physical page allocator for device rings and I/O buffers.
+// Pages above the heap are handed out by a bump pointer; freed pages go on
+// a free list and are reused first, so init costs nothing.
+#define PAGE_SIZE 4096
+#define RAM_END 0x88000000  // QEMU virt default: 128MB at 0x80000000
+#define PAGE_POOL_START HEAP_END
+
+static char* page_bump = (char*)PAGE_POOL_START;
+static void* page_free_list = 0;
+
+long pages_in_use = 0;
+long pages_peak = 0;
+
+// Allocate one zeroed, page-aligned page (NULL if out of memory)
+void* page_alloc(void) {
+    void* page;
+    if (page_free_list) {
+        page = page_free_list;
+        page_free_list = *(void**)page;
+    } else if (page_bump + PAGE_SIZE <= (char*)RAM_END) {
+        page = page_bump;
+        page_bump += PAGE_SIZE;
+    } else {
+        return 0;
     }
     
-    void* ptr = (void*)heap_ptr;
-    heap_ptr += size;
-    
-    mem_total_allocated += size;
-    mem_current_usage += size;
-    mem_num_allocations++;
-    
-    if (mem_current_usage > mem_peak_usage) {
-        mem_peak_usage = mem_current_usage;
+    memset(page, 0, PAGE_SIZE);
+    pages_in_use++;
+    if (pages_in_use > pages_peak) {
+        pages_peak = pages_in_use;
     }
-    
-    return ptr;
+    return page;
+}
+
+void page_free(void* page) {
+    if (page == 0) return;
+    *(void**)page = page_free_list;
+    page_free_list = page;
+    pages_in_use--;
+}
+
+// Pages that can still be allocated
+long pages_available(void) {
+    long n = ((char*)RAM_END - page_bump) / PAGE_SIZE;
+    for (void* p = page_free_list; p; p = *(void**)p) n++;
+    return n;
+}
+
+// Phase 19: Latency Tracing
+
+// QEMU virt timebase (rdtime ticks per second)
+#define TIMEBASE_HZ 10000000
+#define MAX_HARTS 8
+#define LAT_BUCKETS 32
+
+// Read the platform timer (rdtime)
+static inline unsigned long read_time(void) {
+    unsigned long t;
+    asm volatile("csrr %0, time" : "=r"(t));
+    return t;
+}
+
+// Convert timer ticks to nanoseconds
+unsigned long ticks_to_ns(unsigned long t) {
+    return t * (1000000000UL / TIMEBASE_HZ);
+}
+
+// Current hart id (start.S keeps it in tp, which C code never touches)
+static inline long cpu_id(void) {
+    long id;
+    asm volatile("mv %0, tp" : "=r"(id));
+    return id;
 }
 
-// Forward declaration of free() for use in realloc()
-void free(void* ptr);
+// Worst-case histogram for one kind of latency
+typedef struct {
+    unsigned long count;
+    unsigned long total;                // Sum of all samples (ticks)
+    unsigned long max;                  // Worst sample (ticks)
+    unsigned long max_site;             // Call site (pc) of the worst sample
+    long max_pid;                       // Process that was current/woken, -1 if none
+    unsigned long buckets[LAT_BUCKETS]; // log2 buckets: [2^b, 2^(b+1)) ticks
+} lat_hist_t;
+
+// Per-hart tracer state
+typedef struct {
+    lat_hist_t irqs_off;                // Time with interrupts masked (sie cleared or in a trap)
+    lat_hist_t sched;                   // Wakeup -> run latency
+    unsigned long irqs_off_start;       // Timestamp of the outstanding mask, 0 if unmasked
+    unsigned long irqs_off_site;        // Who masked them
+} lat_hart_t;
+
+// One slot per traced hart, plus a scratch slot that absorbs (and drops)
+// samples from hart ids past MAX_HARTS
+lat_hart_t lat_harts[MAX_HARTS + 1];
+
+// Tracer state of the current hart
+lat_hart_t* lat_hart(void) {
+    long id = cpu_id();
+    return &lat_harts[id >= 0 && id < MAX_HARTS ? id : MAX_HARTS];
+}
 
-// Realloc - allocate new block and copy data
-// Note: With bump allocator, we don't track original sizes, so we can't copy properly
-// This is a stub that allocates new memory but doesn't copy old data
-void* realloc(void* ptr, long size) {
-    if (ptr == 0) {
-        return malloc(size);  // If ptr is NULL, behave like malloc
+// Add one sample to a histogram
+void lat_record(lat_hist_t* h, unsigned long delta, unsigned long site, long pid) {
+    int b = 0;
+    unsigned long v = delta;
+    while (v > 1 && b < LAT_BUCKETS - 1) {
+        v >>= 1;
+        b++;
     }
-    
-    if (size == 0) {
-        // Note: bump allocator can't truly free, but we track the attempt
-        free(ptr);
-        return 0;
+    h->buckets[b]++;
+    h->count++;
+    h->total += delta;
+    if (delta >= h->max) {
+        h->max = delta;
+        h->max_site = site;
+        h->max_pid = pid;
     }
-    
-    // Allocate new block (we don't have original size info with bump allocator)
-    void* new_ptr = malloc(size);
-    
-    // WARNING: We cannot copy data because we don't track original block sizes
-    // This is a fundamental limitation of the bump allocator
-    // A real implementation would use a proper malloc with metadata
-    
-    return new_ptr;
 }
 
-// Free - in bump allocator we can't truly free, but we track it
-// With a proper allocator, we would decrement mem_current_usage
-void free(void* ptr) {
-    if (ptr == 0) return;
-    
-    // With a simple bump allocator, we can't actually free memory
-    // In a real implementation with malloc metadata, we would:
-    //   1. Find the block size from metadata
-    //   2. Decrement mem_current_usage by block size
-    //   3. Increment mem_total_freed by block size
-    //   4. Add the block back to a free list
-    
-    // For now, just track the attempt
-    mem_num_frees++;
+// Upper bound (ticks) below which `permille` of the samples fall
+unsigned long lat_percentile(lat_hist_t* h, int permille) {
+    if (h->count == 0) return 0;
+    unsigned long want = (h->count * permille + 999) / 1000;
+    unsigned long seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= want) {
+            unsigned long bound = (2UL << b) - 1;
+            return bound < h->max ? bound : h->max;
+        }
+    }
+    return h->max;
 }
 
-// Get remaining heap space
-long heap_available(void) {
-    return (long)(heap_end - heap_ptr);
+void lat_reset(void) {
+    for (int i = 0; i < MAX_HARTS; i++) {
+        memset(&lat_harts[i].irqs_off, 0, sizeof(lat_hist_t));
+        memset(&lat_harts[i].sched, 0, sizeof(lat_hist_t));
+        lat_harts[i].irqs_off.max_pid = -1;
+        lat_harts[i].sched.max_pid = -1;
+    }
 }
 
 // Phase 4: Process Management
@@ -513,6 +277,12 @@ typedef struct {
     long sstatus;
 } trap_frame_t;
 
+// Kernel thread context: the callee-saved registers (must match kthread_switch)
+typedef struct {
+    long ra, sp;
+    long s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11;
+} kcontext_t;
+
 // Process Control Block
 typedef struct proc {
     int pid;                    // Process ID
@@ -521,6 +291,16 @@ typedef struct proc {
     long* stack;                // Process stack pointer
     int priority;               // Priority level (0=highest)
     int time_slice;             // Time slice remaining
+    unsigned long ready_time;   // When it last became runnable (latency tracer)
+    unsigned long wake_site;    // Who made it runnable
+    void* wait_chan;            // What it sleeps on while BLOCKED
+    unsigned long futex_key;    // Futex word it waits on (0 = not in a bucket)
+    struct proc* futex_next;    // Next waiter in the same futex bucket
+    kcontext_t context;         // Saved registers while switched out
+    void (*entry)(void*);       // Kernel thread body and its argument
+    void* arg;
+    const char* name;
+    int kthread;                // Kernel thread (stack from the page allocator)
     struct proc* next;          // Next in queue
 } proc_t;
 
@@ -545,31 +325,46 @@ void proc_init(void) {
     ticks = 0;
 }
 
-// Allocate a new process
-proc_t* proc_alloc(void) {
+// Claim a free process table slot
+proc_t* proc_claim(void) {
     for (int i = 0; i < MAX_PROCS; i++) {
         if (proc_table[i].state == PROC_UNUSED) {
-            proc_table[i].pid = next_pid++;
-            proc_table[i].state = PROC_READY;
-            proc_table[i].priority = 0;
-            proc_table[i].time_slice = 10;  // 10 time slices per process
-            proc_table[i].next = 0;
-            
-            // Allocate stack for process (4KB)
-            proc_table[i].stack = (long*)malloc(4096);
-            if (!proc_table[i].stack) return 0;
-            
-            // Allocate trap frame
-            proc_table[i].trap_frame = (trap_frame_t*)malloc(sizeof(trap_frame_t));
-            if (!proc_table[i].trap_frame) {
-                free(proc_table[i].stack);
-                return 0;
-            }
-            
-            return &proc_table[i];
+            proc_t* p = &proc_table[i];
+            p->pid = next_pid++;
+            p->state = PROC_READY;
+            p->priority = 0;
+            p->time_slice = 10;  // 10 time slices per process
+            p->wait_chan = 0;
+            p->futex_key = 0;
+            p->futex_next = 0;
+            p->name = 0;
+            p->kthread = 0;
+            p->stack = 0;
+            p->trap_frame = 0;
+            p->next = 0;
+            return p;
         }
     }
-    return 0;  // No free process slot
+    return 0;
+}
+
+// Allocate a new process
+proc_t* proc_alloc(void) {
+    proc_t* p = proc_claim();
+    if (!p) return 0;  // No free process slot
+    
+    // Allocate stack for process (4KB)
+    p->stack = (long*)malloc(4096);
+    if (!p->stack) return 0;
+    
+    // Allocate trap frame
+    p->trap_frame = (trap_frame_t*)malloc(sizeof(trap_frame_t));
+    if (!p->trap_frame) {
+        free(p->stack);
+        return 0;
+    }
+    
+    return p;
 }
 
 // Free a process
@@ -583,8 +378,10 @@ void proc_free(proc_t* p) {
 }
 
 // Add process to ready queue
-void proc_enqueue(proc_t* p) {
+__attribute__((noinline)) void proc_enqueue(proc_t* p) {
     if (p->state == PROC_READY) {
+        p->ready_time = read_time();
+        p->wake_site = (unsigned long)__builtin_return_address(0);
         if (!ready_queue) {
             ready_queue = p;
             p->next = 0;
@@ -609,32 +406,102 @@ proc_t* proc_dequeue(void) {
     return 0;
 }
 
+// Remove a process from the ready queue (if it is on it)
+void proc_unqueue(proc_t* p) {
+    proc_t** pp = &ready_queue;
+    while (*pp) {
+        if (*pp == p) {
+            *pp = p->next;
+            p->next = 0;
+            return;
+        }
+        pp = &(*pp)->next;
+    }
+}
+
+// Mark a dequeued process as running and account its wakeup -> run latency
+void proc_dispatch(proc_t* p) {
+    p->state = PROC_RUNNING;
+    current_proc = p;
+    lat_record(&lat_hart()->sched, read_time() - p->ready_time, p->wake_site, p->pid);
+}
+
 // Phase 9: Interrupt & Exception Handling
 
 // Trap types
+#define TRAP_SOFTWARE 1         // Software interrupt (self-IPI)
 #define TRAP_TIMER 5            // Timer interrupt (bit 5 in scause)
+#define TRAP_EXTERNAL 9         // External interrupt (PLIC)
 #define TRAP_ECALL 8            // Environment call (syscall)
 
+#define SSTATUS_SIE 0x2         // Global supervisor interrupt enable
+#define SIP_SSIP 0x2            // Supervisor software interrupt pending
+#define TIMER_HZ 100            // Scheduler tick rate
+
 // Enable timer interrupt
 void enable_timer(void) {
     // Enable supervisor timer interrupt in SIE
     long sie = 0x20;  // STIE (Supervisor Timer Interrupt Enable)
     asm volatile("csrs sie, %0" : : "r"(sie));
     
-    // Set timer via SBI
-    // For now we'll use busy-wait, proper timer setup comes later
+    // Arm the first tick; handle_trap re-arms it on every tick
+    sbi_set_timer(read_time() + TIMEBASE_HZ / TIMER_HZ);
+}
+
+// Latency tracer hooks: called on every sie mask/unmask transition
+void trace_irqs_off(unsigned long site) {
+    lat_hart_t* lh = lat_hart();
+    if (lh->irqs_off_start == 0) {
+        lh->irqs_off_start = read_time();
+        lh->irqs_off_site = site;
+    }
+}
+
+void trace_irqs_on(void) {
+    lat_hart_t* lh = lat_hart();
+    if (lh->irqs_off_start != 0) {
+        lat_record(&lh->irqs_off, read_time() - lh->irqs_off_start, lh->irqs_off_site,
+                   current_proc ? current_proc->pid : -1);
+        lh->irqs_off_start = 0;
+    }
 }
 
 // Disable interrupts
-void disable_interrupts(void) {
+__attribute__((noinline)) void disable_interrupts(void) {
     asm volatile("csrc sie, %0" : : "r"(~0UL));
+    trace_irqs_off((unsigned long)__builtin_return_address(0));
 }
 
 // Enable interrupts
 void enable_interrupts(void) {
+    trace_irqs_on();
     // Enable supervisor interrupts and user interrupts
     long sie = 0x222;  // SSIE | STIE | SEIE
     asm volatile("csrs sie, %0" : : "r"(sie));
+    
+    // Global enable; masking from here on is done through sie
+    asm volatile("csrs sstatus, %0" : : "r"(SSTATUS_SIE));
+}
+
+// Mask interrupts and return the previous sie, for nestable critical sections
+__attribute__((noinline)) long irq_save(void) {
+    long flags;
+    long sstatus;
+    asm volatile("csrrc %0, sie, %1" : "=r"(flags) : "r"(~0UL));
+    asm volatile("csrr %0, sstatus" : "=r"(sstatus));
+    if (flags && (sstatus & SSTATUS_SIE)) trace_irqs_off((unsigned long)__builtin_return_address(0));
+    return flags;
+}
+
+// Restore the sie saved by irq_save(). The irqs-off section only ends if
+// sstatus.SIE isn't clear as well (see intr_off).
+void irq_restore(long flags) {
+    if (flags) {
+        long sstatus;
+        asm volatile("csrr %0, sstatus" : "=r"(sstatus));
+        if (sstatus & SSTATUS_SIE) trace_irqs_on();
+        asm volatile("csrs sie, %0" : : "r"(flags));
+    }
 }
 
 // Get current program counter
@@ -651,180 +518,3005 @@ long get_scause(void) {
     return scause;
 }
 
+// Forward declarations: external interrupts are routed by the PLIC code
+// below, and preemption is done by the kernel thread scheduler
+void plic_dispatch(void);
+void proc_wakeup(void* chan);
+void proc_preempt(void);
+long syscall(long nr, long a0, long a1, long a2);
+
 // Trap handler (called from assembly)
 void handle_trap(trap_frame_t* tf) {
+    unsigned long trap_start = read_time();
     long scause = get_scause();
     long is_interrupt = scause & 0x8000000000000000UL;
     long cause = scause & 0x7FFFFFFFFFFFFFFF;
+    int need_resched = 0;
     
     if (is_interrupt) {
         // Handle interrupt
         if (cause == TRAP_TIMER) {  // Timer interrupt
             ticks++;
-            
-            // Decrement time slice
-            if (current_proc) {
-                current_proc->time_slice--;
-                
-                // If time slice expired, do context switch
-                if (current_proc->time_slice <= 0) {
-                    current_proc->state = PROC_READY;
-                    current_proc->time_slice = 10;
-                    proc_enqueue(current_proc);
-                    
-                    // Get next process
-                    proc_t* next = proc_dequeue();
-                    if (next) {
-                        next->state = PROC_RUNNING;
-                        current_proc = next;
-                        // In a real implementation, restore trap frame here
-                    }
-                }
-            }
+            sbi_set_timer(read_time() + TIMEBASE_HZ / TIMER_HZ);
+            proc_wakeup(&ticks);
+        } else if (cause == TRAP_SOFTWARE) {
+            // Self-IPI: a request to reschedule through the trap path
+            asm volatile("csrc sip, %0" : : "r"(SIP_SSIP));
+            need_resched = 1;
+        } else if (cause == TRAP_EXTERNAL) {
+            plic_dispatch();
         }
     } else {
         // Handle exception
         if (cause == TRAP_ECALL) {  // Environment call (syscall)
-            // Handle syscall - stub for now
+            // Only a U-mode ecall lands here (an S-mode one goes to OpenSBI).
+            // Nothing runs in U-mode yet, so this path is untested.
             tf->sepc += 4;  // Move past ecall instruction
+            // A syscall may sleep while other threads run; account the trap
+            // before dispatching so the sleep isn't counted as irqs-off time
+            lat_record(&lat_hart()->irqs_off, read_time() - trap_start, tf->sepc,
+                       current_proc ? current_proc->pid : -1);
+            trap_start = 0;
+            tf->a0 = syscall(tf->a7, tf->a0, tf->a1, tf->a2);
         } else {
             // Unhandled exception
             printf("Unhandled exception: %x\n", cause, 0, 0, 0, 0, 0);
         }
     }
+    
+    // The hart runs the whole handler with SIE cleared; account it as irqs-off time
+    if (trap_start) {
+        lat_record(&lat_hart()->irqs_off, read_time() - trap_start, tf->sepc,
+                   current_proc ? current_proc->pid : -1);
+    }
+    
+    // The trap frame stays on this thread's stack; we return through it
+    // when the thread is next scheduled
+    if (need_resched && current_proc && current_proc->state == PROC_RUNNING) {
+        proc_preempt();
+    }
 }
 
-// Parse command line into argv
-int parse_args(char* line, char** argv, int max_args) {
-    int argc = 0;
-    char* p = line;
-    
-    while (*p && argc < max_args) {
-        // Skip whitespace
-        while (*p == ' ' || *p == '\t') p++;
-        if (!*p) break;
-        
-        // Found start of argument
-        argv[argc++] = p;
-        
-        // Find end of argument
-        while (*p && *p != ' ' && *p != '\t') p++;
-        if (*p) *p++ = '\0';
+// Kernel Threads
+//
+// Kernel threads are proc_t entries with their own stack, scheduled from the
+// same ready queue. A voluntary switch (kthread_yield, proc_sleep,
+// kthread_exit) goes through kthread_switch, which saves only the
+// callee-saved registers. Preemption happens at the end of a trap raised
+// by proc_kick (a self-IPI), with the full trap frame already saved on the
+// stack. The timer doesn't preempt: kernel code that isn't inside an
+// intr_off() section still counts on running until it switches itself.
+//
+// Scheduler state is protected by clearing sstatus.SIE rather than masking
+// sie: sstatus is part of the trap frame, so every thread gets its own
+// interrupt state back when it resumes.
+#define KTHREAD_STACK_SIZE PAGE_SIZE
+
+long ctx_switches;              // Thread switches since boot
+proc_t* kthread_dead;           // Exited thread whose stack is still in use
+
+// Assembly: save callee-saved registers into *old, resume *new (start.S)
+void kthread_switch(kcontext_t* old, kcontext_t* new);
+
+// Clear sstatus.SIE, returning whether it was set
+__attribute__((noinline)) long intr_off(void) {
+    long s;
+    asm volatile("csrrc %0, sstatus, %1" : "=r"(s) : "r"(SSTATUS_SIE));
+    if (s & SSTATUS_SIE) trace_irqs_off((unsigned long)__builtin_return_address(0));
+    return s & SSTATUS_SIE;
+}
+
+// Restore the sstatus.SIE saved by intr_off(). The irqs-off section only
+// ends if sie isn't masked as well.
+void intr_restore(long s) {
+    if (s) {
+        long sie;
+        asm volatile("csrr %0, sie" : "=r"(sie));
+        if (sie) trace_irqs_on();
+        asm volatile("csrs sstatus, %0" : : "r"(SSTATUS_SIE));
+    }
+}
+
+// Wait for an interrupt with SIE clear. The time spent asleep isn't
+// irqs-off latency: wfi wakes on the pending interrupt and the caller
+// opens SIE right after. Inside a trap no section is open, so none is
+// reopened either.
+__attribute__((noinline)) void intr_wait(void) {
+    int traced = lat_hart()->irqs_off_start != 0;
+    trace_irqs_on();
+    asm volatile("wfi");
+    if (traced) trace_irqs_off((unsigned long)__builtin_return_address(0));
+}
+
+// Free the stack of a thread that has switched away for the last time
+void kthread_reap(void) {
+    proc_t* p = kthread_dead;
+    if (!p) return;
+    kthread_dead = 0;
+    page_free(p->stack);
+    p->stack = 0;
+    p->state = PROC_UNUSED;
+    p->pid = -1;
+}
+
+// Switch to the next ready thread. Called with SIE clear after the caller
+// has set its own state (and requeued itself if it stays runnable); returns
+// when the caller is scheduled again.
+void sched(void) {
+    proc_t* prev = current_proc;
+    proc_t* next;
+    while (!(next = proc_dequeue())) {
+        // Nothing runnable: idle until an interrupt makes something ready
+        current_proc = 0;
+        intr_wait();
+        asm volatile("csrs sstatus, %0" : : "r"(SSTATUS_SIE));
+        asm volatile("csrc sstatus, %0" : : "r"(SSTATUS_SIE));
     }
+    proc_dispatch(next);
+    if (next == prev) return;
     
-    return argc;
+    ctx_switches++;
+    kthread_switch(&prev->context, &next->context);
+    kthread_reap();
 }
 
-// Command: help
-void cmd_help(void) {
-    puts_ln("Available commands:");
-    puts_ln("  help     - Show this help message");
-    puts_ln("  echo     - Echo arguments back");
-    puts_ln("  clear    - Clear the screen");
-    puts_ln("  meminfo  - Show memory statistics");
-    puts_ln("  procs    - List active processes");
+// Terminate the calling thread
+void kthread_exit(void) {
+    intr_off();
+    current_proc->state = PROC_ZOMBIE;
+    kthread_dead = current_proc;
+    sched();
 }
 
-// Command: echo
-void cmd_echo(int argc, char** argv) {
-    for (int i = 1; i < argc; i++) {
-        // Don't use puts() which adds newline - just print the string
-        for (char* p = argv[i]; *p; p++) {
-            putchar(*p);
-        }
-        if (i < argc - 1) putchar(' ');
+// First code run by a new thread (kthread_switch "returns" here)
+void kthread_start(void) {
+    kthread_reap();
+    intr_restore(1);
+    current_proc->entry(current_proc->arg);
+    kthread_exit();
+}
+
+// Turn the running boot context into a thread so it can be scheduled
+proc_t* kthread_init(const char* name) {
+    proc_t* p = proc_claim();
+    if (!p) return 0;
+    p->name = name;
+    p->kthread = 1;
+    p->state = PROC_RUNNING;
+    current_proc = p;
+    return p;
+}
+
+// Create a ready kernel thread running entry(arg)
+proc_t* kthread_create(const char* name, void (*entry)(void*), void* arg) {
+    long s = intr_off();
+    proc_t* p = proc_claim();
+    if (!p) {
+        intr_restore(s);
+        return 0;
     }
-    putchar('\n');
+    p->stack = (long*)page_alloc();
+    if (!p->stack) {
+        p->state = PROC_UNUSED;
+        p->pid = -1;
+        intr_restore(s);
+        return 0;
+    }
+    p->name = name;
+    p->kthread = 1;
+    p->entry = entry;
+    p->arg = arg;
+    memset(&p->context, 0, sizeof(kcontext_t));
+    p->context.ra = (long)kthread_start;
+    p->context.sp = (long)p->stack + KTHREAD_STACK_SIZE;
+    proc_enqueue(p);
+    intr_restore(s);
+    return p;
 }
 
-// Command: clear
-void cmd_clear(void) {
-    puts("\033[2J\033[H");
+// Give the CPU to the next ready thread, if there is one
+void kthread_yield(void) {
+    proc_t* p = current_proc;
+    if (!p) return;
+    long s = intr_off();
+    if (ready_queue) {
+        p->state = PROC_READY;
+        proc_enqueue(p);
+        sched();
+    }
+    intr_restore(s);
 }
 
-// Command: meminfo
-void cmd_meminfo(void) {
-    printf("Memory Statistics:\n", 0, 0, 0, 0, 0, 0);
-    printf("  Total Allocated: %x bytes\n", mem_total_allocated, 0, 0, 0, 0, 0);
-    printf("  Total Freed:     %x bytes\n", mem_total_freed, 0, 0, 0, 0, 0);
-    printf("  Current Usage:   %x bytes\n", mem_current_usage, 0, 0, 0, 0, 0);
-    printf("  Peak Usage:      %x bytes\n", mem_peak_usage, 0, 0, 0, 0, 0);
-    printf("  Available:       %x bytes\n", heap_available(), 0, 0, 0, 0, 0);
-    printf("  Total Heap:      %x bytes\n", HEAP_SIZE, 0, 0, 0, 0, 0);
-    printf("  Allocations:     %x\n", mem_num_allocations, 0, 0, 0, 0, 0);
-    printf("  Frees:           %x\n", mem_num_frees, 0, 0, 0, 0, 0);
+// Called at the end of a trap (SIE clear): requeue the interrupted thread
+void proc_preempt(void) {
+    proc_t* p = current_proc;
+    p->state = PROC_READY;
+    proc_enqueue(p);
+    sched();
 }
 
-// Command: procs
-void cmd_procs(void) {
-    printf("Process Table:\n", 0, 0, 0, 0, 0, 0);
-    printf("  PID  State        Priority\n", 0, 0, 0, 0, 0, 0);
+// Ask for a trap-based reschedule of this hart (self software interrupt)
+void proc_kick(void) {
+    asm volatile("csrs sip, %0" : : "r"(SIP_SSIP));
+}
+
+// Block the current thread until proc_wakeup(chan). To not miss a wakeup,
+// callers check their condition and sleep with SIE clear (intr_off); they
+// re-check it in a loop, since wakeups can be spurious.
+void proc_sleep(void* chan) {
+    proc_t* p = current_proc;
+    if (!p) {
+        // Not a thread (early boot): just wait for an interrupt
+        asm volatile("wfi");
+        return;
+    }
     
+    long s = intr_off();
+    p->wait_chan = chan;
+    p->state = PROC_BLOCKED;
+    sched();
+    intr_restore(s);
+}
+
+void futex_unlink(proc_t* p);
+
+// Make every thread sleeping on `chan` runnable
+void proc_wakeup(void* chan) {
+    long s = intr_off();
     for (int i = 0; i < MAX_PROCS; i++) {
-        if (proc_table[i].state != PROC_UNUSED) {
-            char* state_str = "";
-            switch (proc_table[i].state) {
-                case PROC_READY: state_str = "READY"; break;
-                case PROC_RUNNING: state_str = "RUNNING"; break;
-                case PROC_BLOCKED: state_str = "BLOCKED"; break;
-                case PROC_ZOMBIE: state_str = "ZOMBIE"; break;
-                default: state_str = "?"; break;
-            }
-            
-            printf("  %x    %s         %d\n", proc_table[i].pid, (long)state_str, proc_table[i].priority, 0, 0, 0);
+        proc_t* p = &proc_table[i];
+        if (p->state == PROC_BLOCKED && p->wait_chan == chan) {
+            if (p->futex_key) futex_unlink(p);
+            p->wait_chan = 0;
+            p->state = PROC_READY;
+            proc_enqueue(p);
         }
     }
-    printf("  Ticks: %x\n", ticks, 0, 0, 0, 0, 0);
+    intr_restore(s);
 }
 
-// Execute a command
-void execute_command(char* line) {
-    char* argv[16];
-    int argc = parse_args(line, argv, 16);
-    
-    if (argc == 0) return;
-    
-    if (strcmp(argv[0], "help") == 0) {
-        cmd_help();
-    } else if (strcmp(argv[0], "echo") == 0) {
-        cmd_echo(argc, argv);
-    } else if (strcmp(argv[0], "clear") == 0) {
-        cmd_clear();
-    } else if (strcmp(argv[0], "meminfo") == 0) {
-        cmd_meminfo();
-    } else if (strcmp(argv[0], "procs") == 0) {
-        cmd_procs();
-    } else {
-        puts("Unknown command: ");
-        puts(argv[0]);
-        putchar('\n');
-        puts_ln("Type 'help' for available commands.");
-    }
+// Sleep for `n` timer ticks
+void kthread_sleep(long n) {
+    long until = ticks + n;
+    long s = intr_off();
+    while (ticks < until) proc_sleep(&ticks);
+    intr_restore(s);
 }
 
-// Main kernel entry point
-void kernel_main(void) {
-    // Initialize memory management
-    mem_init();
+// Phase 5: System Calls
+//
+// Futexes: user space keeps lock state in a shared word and only calls in
+// to sleep while the word still holds an expected value, or to wake
+// sleepers (see ulock.h). Waiters are kept in a hash table keyed by the
+// word's physical address, so threads mapping it at different virtual
+// addresses still meet. The value check and the enqueue happen with SIE
+// clear, so a wake from another thread can't slip in between.
+#define FUTEX_HASH_SIZE 64
+
+proc_t* futex_table[FUTEX_HASH_SIZE];   // FIFO chains of waiters
+long futex_waits;               // Slow-path calls to wait
+long futex_wakes;               // Slow-path calls to wake
+
+// Physical address of a word (identity mapped until there is virtual memory)
+unsigned long futex_key(volatile uint32_t* addr) {
+    return (unsigned long)addr;
+}
+
+proc_t** futex_bucket(unsigned long key) {
+    return &futex_table[((key >> 2) ^ (key >> 12)) % FUTEX_HASH_SIZE];
+}
+
+// Sleep until woken if *addr == val. Returns 0 once woken, -1 if the value
+// had already changed.
+long futex_wait(volatile uint32_t* addr, uint32_t val) {
+    proc_t* p = current_proc;
+    unsigned long key = futex_key(addr);
+    long s = intr_off();
+    futex_waits++;
+    if (!p || *addr != val) {
+        intr_restore(s);
+        return -1;
+    }
     
-    // Initialize process management
-    proc_init();
+    proc_t** pp = futex_bucket(key);
+    while (*pp) pp = &(*pp)->futex_next;
+    *pp = p;
+    p->futex_next = 0;
+    p->futex_key = key;
+    p->wait_chan = futex_table;     // Not a channel anyone passes to proc_wakeup
+    p->state = PROC_BLOCKED;
+    sched();
+    intr_restore(s);
+    return 0;
+}
+
+// Take a waiter off its futex chain (it is being woken some other way)
+void futex_unlink(proc_t* p) {
+    proc_t** pp = futex_bucket(p->futex_key);
+    while (*pp && *pp != p) pp = &(*pp)->futex_next;
+    if (*pp) *pp = p->futex_next;
+    p->futex_next = 0;
+    p->futex_key = 0;
+}
+
+// Wake up to n threads waiting on addr; returns how many were woken
+long futex_wake(volatile uint32_t* addr, int n) {
+    unsigned long key = futex_key(addr);
+    long woken = 0;
+    long s = intr_off();
+    futex_wakes++;
+    proc_t** pp = futex_bucket(key);
+    while (*pp && woken < n) {
+        proc_t* p = *pp;
+        if (p->futex_key != key) {
+            pp = &p->futex_next;
+            continue;
+        }
+        *pp = p->futex_next;
+        p->futex_next = 0;
+        p->futex_key = 0;
+        p->wait_chan = 0;
+        p->state = PROC_READY;
+        proc_enqueue(p);
+        woken++;
+    }
+    intr_restore(s);
+    return woken;
+}
+
+int sys_chan_wait(int id, int producer);
+int sys_chan_wake(int id, int producer);
+int sys_msg_send(int id, const void* buf, uint32_t len);
+long sys_msg_recv(int id, void* buf, uint32_t max);
+
+// System call dispatch (ecall from user mode: number in a7). Untested
+// until there are U-mode programs; kernel threads call the functions.
+long syscall(long nr, long a0, long a1, long a2) {
+    switch (nr) {
+        case SYS_FUTEX_WAIT: return futex_wait((volatile uint32_t*)a0, (uint32_t)a1);
+        case SYS_FUTEX_WAKE: return futex_wake((volatile uint32_t*)a0, (int)a1);
+        case SYS_CHAN_WAIT:  return sys_chan_wait((int)a0, (int)a1);
+        case SYS_CHAN_WAKE:  return sys_chan_wake((int)a0, (int)a1);
+        case SYS_MSG_SEND:   return sys_msg_send((int)a0, (const void*)a1, (uint32_t)a2);
+        case SYS_MSG_RECV:   return sys_msg_recv((int)a0, (void*)a1, (uint32_t)a2);
+        default: return -1;
+    }
+}
+
+// Phase 22: Device & Driver Framework
+
+// PLIC (platform-level interrupt controller) on the QEMU virt machine.
+// Each hart has an M-mode and an S-mode context; we use the S-mode one (2*hart+1).
+#define PLIC_BASE 0x0c000000
+#define PLIC_MAX_IRQ 64
+#define PLIC_PRIORITY(irq)    (PLIC_BASE + 4 * (irq))
+#define PLIC_SENABLE(hart)    (PLIC_BASE + 0x2080 + (hart) * 0x100)
+#define PLIC_STHRESHOLD(hart) (PLIC_BASE + 0x201000 + (hart) * 0x2000)
+#define PLIC_SCLAIM(hart)     (PLIC_BASE + 0x201004 + (hart) * 0x2000)
+
+#define REG32(addr) (*(volatile uint32_t*)(unsigned long)(addr))
+
+// IRQ handler table
+typedef void (*irq_handler_t)(void* arg);
+irq_handler_t irq_handlers[PLIC_MAX_IRQ];
+void* irq_args[PLIC_MAX_IRQ];
+
+// Route a PLIC interrupt to this hart and register its handler
+void irq_register(int irq, irq_handler_t handler, void* arg) {
+    if (irq <= 0 || irq >= PLIC_MAX_IRQ) return;
+    irq_handlers[irq] = handler;
+    irq_args[irq] = arg;
+    
+    long hart = cpu_id();
+    REG32(PLIC_PRIORITY(irq)) = 1;
+    REG32(PLIC_SENABLE(hart) + (irq / 32) * 4) |= 1U << (irq % 32);
+    REG32(PLIC_STHRESHOLD(hart)) = 0;
+}
+
+// Claim, handle and complete every pending external interrupt
+void plic_dispatch(void) {
+    long hart = cpu_id();
+    uint32_t irq;
+    while ((irq = REG32(PLIC_SCLAIM(hart))) != 0) {
+        if (irq < PLIC_MAX_IRQ && irq_handlers[irq]) {
+            irq_handlers[irq](irq_args[irq]);
+        } else {
+            printf("Spurious external interrupt: %d\n", irq, 0, 0, 0, 0, 0);
+        }
+        REG32(PLIC_SCLAIM(hart)) = irq;
+    }
+}
+
+// Goldfish RTC on the QEMU virt machine (nanoseconds since the epoch)
+#define RTC_BASE 0x00101000
+#define RTC_TIME_LOW  0x00      // Reading this latches TIME_HIGH
+#define RTC_TIME_HIGH 0x04
+
+uint64_t rtc_seconds(void) {
+    uint64_t lo = REG32(RTC_BASE + RTC_TIME_LOW);
+    uint64_t hi = REG32(RTC_BASE + RTC_TIME_HIGH);
+    return ((hi << 32) | lo) / 1000000000UL;
+}
+
+// virtio-blk driver (virtio-mmio, modern interface, split virtqueue)
+//
+// Requests are asynchronous: virtio_blk_submit() queues a request and
+// publishes it in the available ring, virtio_blk_kick() notifies the device
+// once for a whole batch, and completions are reaped from the used ring by
+// the PLIC interrupt (or by virtio_blk_poll()). With EVENT_IDX negotiated,
+// kicks the device doesn't need are suppressed, as are interrupts until the
+// driver has caught up with the used ring.
+#define VIRTQ_SIZE 128          // Descriptors per queue
+#define BLK_MAX_SEGS 16         // Data segments per request
+#define VIRTIO_BLK_MAX 4        // Block devices we drive
+
+// One data segment of a request
+typedef struct {
+    void* addr;
+    uint32_t len;               // Multiple of VIRTIO_BLK_SECTOR_SIZE
+} blk_seg_t;
+
+// Asynchronous block request (owned by the caller until done is set)
+typedef struct blk_req {
+    int op;                     // VIRTIO_BLK_T_IN / _OUT / _FLUSH
+    uint64_t sector;            // Starting 512-byte sector
+    int nseg;                   // Number of data segments (0 for flush)
+    blk_seg_t seg[BLK_MAX_SEGS];
+    volatile int done;          // Set once the device has completed it
+    int status;                 // VIRTIO_BLK_S_* once done
+    void (*complete)(struct blk_req* r);  // Optional, runs with interrupts masked
+    void* priv;                 // Caller data for the callback
+} blk_req_t;
+
+typedef struct {
+    unsigned long base;         // MMIO base of the slot
+    int irq;
+    int event_idx;              // VIRTIO_RING_F_EVENT_IDX negotiated
+    int read_only;
+    int has_flush;              // VIRTIO_BLK_F_FLUSH negotiated
+    uint64_t capacity;          // Size in sectors
+    int qsize;
+    
+    volatile struct vring_desc* desc;
+    volatile struct vring_avail* avail;
+    volatile struct vring_used* used;
+    
+    uint16_t free_head;         // Free descriptors, chained through next
+    int num_free;
+    uint16_t avail_idx;         // Next available ring index to publish
+    uint16_t kicked_idx;        // avail_idx at the last kick
+    uint16_t last_used;         // Next used ring entry to reap
+    
+    blk_req_t* inflight[VIRTQ_SIZE];            // By head descriptor
+    struct virtio_blk_outhdr hdr[VIRTQ_SIZE];   // By head descriptor
+    volatile uint8_t status[VIRTQ_SIZE];        // By head descriptor
+    
+    // Statistics
+    long submitted;
+    long completed;
+    long notifies;
+    long interrupts;
+} virtio_blk_t;
+
+virtio_blk_t vblk[VIRTIO_BLK_MAX];
+int vblk_count = 0;
+
+#define VIRTIO_REG(d, off) REG32((d)->base + (off))
+
+// EVENT_IDX fields live just past the end of each ring
+// (offset from a byte pointer: flags + idx, then qsize ring entries)
+#define VRING_USED_EVENT(d)  (*(volatile uint16_t*)((volatile uint8_t*)(d)->avail + 4 + 2 * (d)->qsize))
+#define VRING_AVAIL_EVENT(d) (*(volatile uint16_t*)((volatile uint8_t*)(d)->used + 4 + 8 * (d)->qsize))
+
+// Reap completed requests from the used ring (call with interrupts masked)
+int virtio_blk_complete(virtio_blk_t* d) {
+    int n = 0;
+    while (1) {
+        while (d->last_used != d->used->idx) {
+            __sync_synchronize();  // Read ring entries after the index
+            uint16_t head = d->used->ring[d->last_used % d->qsize].id;
+            blk_req_t* r = d->inflight[head];
+            d->inflight[head] = 0;
+            d->last_used++;
+            
+            // Return the chain to the free list
+            uint16_t last = head;
+            int len = 1;
+            while (d->desc[last].flags & VRING_DESC_F_NEXT) {
+                last = d->desc[last].next;
+                len++;
+            }
+            d->desc[last].next = d->free_head;
+            d->free_head = head;
+            d->num_free += len;
+            
+            d->completed++;
+            n++;
+            if (r) {
+                r->status = d->status[head];
+                r->done = 1;
+                if (r->complete) r->complete(r);
+            }
+        }
+        if (!d->event_idx) break;
+        
+        // Interrupt on the next completion, then re-check to close the race
+        VRING_USED_EVENT(d) = d->last_used;
+        __sync_synchronize();
+        if (d->last_used == d->used->idx) break;
+    }
+    return n;
+}
+
+void virtio_blk_intr(void* arg) {
+    virtio_blk_t* d = (virtio_blk_t*)arg;
+    uint32_t st = VIRTIO_REG(d, VIRTIO_MMIO_INTERRUPT_STATUS);
+    VIRTIO_REG(d, VIRTIO_MMIO_INTERRUPT_ACK) = st & 0x3;
+    d->interrupts++;
+    virtio_blk_complete(d);
+}
+
+// Queue a request without notifying the device.
+// Returns 0, -1 if the queue is full (retry once something completes), or
+// -2 if the request can never be queued (bad device or segments, a write to
+// a read-only disk).
+int virtio_blk_submit(int dev, blk_req_t* r) {
+    if (dev < 0 || dev >= vblk_count) return -2;
+    virtio_blk_t* d = &vblk[dev];
+    if (r->nseg < 0 || r->nseg > BLK_MAX_SEGS) return -2;
+    if (r->op != VIRTIO_BLK_T_FLUSH && r->nseg == 0) return -2;
+    if (r->op == VIRTIO_BLK_T_OUT && d->read_only) return -2;
+    
+    int ndesc = r->nseg + 2;  // Header + data + status
+    if (ndesc > d->qsize) return -2;
+    long flags = irq_save();
+    if (d->num_free < ndesc) {
+        irq_restore(flags);
+        return -1;
+    }
+    
+    // Take ndesc descriptors off the free list; their next links already chain them
+    uint16_t head = d->free_head;
+    uint16_t idx = head;
+    d->hdr[head].type = r->op;
+    d->hdr[head].reserved = 0;
+    d->hdr[head].sector = r->sector;
+    d->status[head] = 0xff;
+    for (int k = 0; k < ndesc; k++) {
+        volatile struct vring_desc* desc = &d->desc[idx];
+        if (k == 0) {
+            desc->addr = (uint64_t)(unsigned long)&d->hdr[head];
+            desc->len = sizeof(struct virtio_blk_outhdr);
+            desc->flags = VRING_DESC_F_NEXT;
+        } else if (k < ndesc - 1) {
+            desc->addr = (uint64_t)(unsigned long)r->seg[k - 1].addr;
+            desc->len = r->seg[k - 1].len;
+            desc->flags = VRING_DESC_F_NEXT |
+                          (r->op == VIRTIO_BLK_T_IN ? VRING_DESC_F_WRITE : 0);
+        } else {
+            desc->addr = (uint64_t)(unsigned long)&d->status[head];
+            desc->len = 1;
+            desc->flags = VRING_DESC_F_WRITE;
+        }
+        if (k < ndesc - 1) idx = desc->next;
+    }
+    d->free_head = d->desc[idx].next;
+    d->num_free -= ndesc;
+    
+    r->done = 0;
+    r->status = 0xff;
+    d->inflight[head] = r;
+    d->avail->ring[d->avail_idx % d->qsize] = head;
+    d->avail_idx++;
+    __sync_synchronize();  // Ring entry before the index
+    d->avail->idx = d->avail_idx;
+    d->submitted++;
+    
+    irq_restore(flags);
+    return 0;
+}
+
+// Tell the device about everything submitted since the last kick
+void virtio_blk_kick(int dev) {
+    if (dev < 0 || dev >= vblk_count) return;
+    virtio_blk_t* d = &vblk[dev];
+    long flags = irq_save();
+    __sync_synchronize();  // Publish avail->idx before reading the event index
+    uint16_t new_idx = d->avail_idx;
+    uint16_t old_idx = d->kicked_idx;
+    if (new_idx != old_idx) {
+        int need = d->event_idx ? vring_need_event(VRING_AVAIL_EVENT(d), new_idx, old_idx)
+                                : !(d->used->flags & VRING_USED_F_NO_NOTIFY);
+        d->kicked_idx = new_idx;
+        if (need) {
+            VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+            d->notifies++;
+        }
+    }
+    irq_restore(flags);
+}
+
+// Reap completions without waiting; returns how many were reaped
+int virtio_blk_poll(int dev) {
+    if (dev < 0 || dev >= vblk_count) return 0;
+    long flags = irq_save();
+    int n = virtio_blk_complete(&vblk[dev]);
+    irq_restore(flags);
+    return n;
+}
+
+// Sleep until something completes after `seen` (a snapshot of d->completed).
+// wfi wakes on any pending interrupt even with SIE cleared, so clearing it
+// here only closes the check-then-sleep race without delaying interrupts.
+// A caller that already runs with SIE clear just polls.
+void virtio_blk_idle(int dev, long seen) {
+    virtio_blk_t* d = &vblk[dev];
+    long s = intr_off();
+    virtio_blk_complete(d);
+    if (d->completed == seen && s) {
+        intr_wait();
+    }
+    intr_restore(s);
+}
+
+// Wait for one request to complete
+void virtio_blk_wait(int dev, blk_req_t* r) {
+    if (dev < 0 || dev >= vblk_count) return;
+    while (!r->done) {
+        long seen = vblk[dev].completed;
+        if (r->done) break;
+        virtio_blk_idle(dev, seen);
+    }
+}
+
+// Synchronous single-buffer read/write; returns 0 on success
+int virtio_blk_rw(int dev, int op, uint64_t sector, void* buf, uint32_t len) {
+    blk_req_t r;
+    r.op = op;
+    r.sector = sector;
+    r.nseg = 1;
+    r.seg[0].addr = buf;
+    r.seg[0].len = len;
+    r.complete = 0;
+    r.priv = 0;
+    
+    int rc;
+    while ((rc = virtio_blk_submit(dev, &r)) != 0) {
+        if (rc != -1) return -1;
+        virtio_blk_kick(dev);
+        virtio_blk_idle(dev, vblk[dev].completed);  // Queue full: wait for room
+    }
+    virtio_blk_kick(dev);
+    virtio_blk_wait(dev, &r);
+    return r.status == VIRTIO_BLK_S_OK ? 0 : -1;
+}
+
+// Flush the device's volatile write cache; returns 0 on success
+int virtio_blk_flush(int dev) {
+    if (dev < 0 || dev >= vblk_count) return -1;
+    if (!vblk[dev].has_flush) return 0;
+    
+    blk_req_t r;
+    r.op = VIRTIO_BLK_T_FLUSH;
+    r.sector = 0;
+    r.nseg = 0;
+    r.complete = 0;
+    r.priv = 0;
+    int rc;
+    while ((rc = virtio_blk_submit(dev, &r)) != 0) {
+        if (rc != -1) return -1;
+        virtio_blk_kick(dev);
+        virtio_blk_idle(dev, vblk[dev].completed);
+    }
+    virtio_blk_kick(dev);
+    virtio_blk_wait(dev, &r);
+    return r.status == VIRTIO_BLK_S_OK ? 0 : -1;
+}
+
+// Bring up one modern virtio-blk device; returns 0 on success
+int virtio_blk_setup(virtio_blk_t* d, unsigned long base, int irq) {
+    d->base = base;
+    d->irq = irq;
+    
+    // Reset, then ACKNOWLEDGE | DRIVER
+    uint32_t status = 0;
+    VIRTIO_REG(d, VIRTIO_MMIO_STATUS) = status;
+    status |= VIRTIO_STATUS_ACKNOWLEDGE;
+    VIRTIO_REG(d, VIRTIO_MMIO_STATUS) = status;
+    status |= VIRTIO_STATUS_DRIVER;
+    VIRTIO_REG(d, VIRTIO_MMIO_STATUS) = status;
+    
+    // Negotiate features
+    VIRTIO_REG(d, VIRTIO_MMIO_DEVICE_FEATURES_SEL) = 0;
+    uint32_t lo = VIRTIO_REG(d, VIRTIO_MMIO_DEVICE_FEATURES);
+    VIRTIO_REG(d, VIRTIO_MMIO_DEVICE_FEATURES_SEL) = 1;
+    uint32_t hi = VIRTIO_REG(d, VIRTIO_MMIO_DEVICE_FEATURES);
+    
+    uint32_t want_lo = lo & ((1U << VIRTIO_BLK_F_SEG_MAX) | (1U << VIRTIO_BLK_F_RO) |
+                             (1U << VIRTIO_BLK_F_FLUSH) | (1U << VIRTIO_RING_F_EVENT_IDX));
+    uint32_t want_hi = hi & (1U << (VIRTIO_F_VERSION_1 - 32));
+    VIRTIO_REG(d, VIRTIO_MMIO_DRIVER_FEATURES_SEL) = 0;
+    VIRTIO_REG(d, VIRTIO_MMIO_DRIVER_FEATURES) = want_lo;
+    VIRTIO_REG(d, VIRTIO_MMIO_DRIVER_FEATURES_SEL) = 1;
+    VIRTIO_REG(d, VIRTIO_MMIO_DRIVER_FEATURES) = want_hi;
+    
+    status |= VIRTIO_STATUS_FEATURES_OK;
+    VIRTIO_REG(d, VIRTIO_MMIO_STATUS) = status;
+    if (!(VIRTIO_REG(d, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+        VIRTIO_REG(d, VIRTIO_MMIO_STATUS) = VIRTIO_STATUS_FAILED;
+        return -1;
+    }
+    d->event_idx = (want_lo >> VIRTIO_RING_F_EVENT_IDX) & 1;
+    d->read_only = (want_lo >> VIRTIO_BLK_F_RO) & 1;
+    d->has_flush = (want_lo >> VIRTIO_BLK_F_FLUSH) & 1;
+    
+    // Set up queue 0: descriptors + available ring in one page, used ring in another
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_SEL) = 0;
+    if (VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_READY)) return -1;
+    uint32_t max = VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (max == 0) return -1;
+    d->qsize = max < VIRTQ_SIZE ? (int)max : VIRTQ_SIZE;
+    
+    char* ring_page = (char*)page_alloc();
+    char* used_page = (char*)page_alloc();
+    if (!ring_page || !used_page) {
+        page_free(ring_page);
+        page_free(used_page);
+        return -1;
+    }
+    d->desc = (volatile struct vring_desc*)ring_page;
+    d->avail = (volatile struct vring_avail*)(ring_page + sizeof(struct vring_desc) * VIRTQ_SIZE);
+    d->used = (volatile struct vring_used*)used_page;
+    
+    for (int i = 0; i < d->qsize; i++) {
+        d->desc[i].next = (uint16_t)(i + 1);
+    }
+    d->free_head = 0;
+    d->num_free = d->qsize;
+    d->avail_idx = 0;
+    d->kicked_idx = 0;
+    d->last_used = 0;
+    
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_NUM) = d->qsize;
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint32_t)(unsigned long)d->desc;
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint32_t)((unsigned long)d->desc >> 32);
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_DRIVER_LOW) = (uint32_t)(unsigned long)d->avail;
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_DRIVER_HIGH) = (uint32_t)((unsigned long)d->avail >> 32);
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_DEVICE_LOW) = (uint32_t)(unsigned long)d->used;
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_DEVICE_HIGH) = (uint32_t)((unsigned long)d->used >> 32);
+    VIRTIO_REG(d, VIRTIO_MMIO_QUEUE_READY) = 1;
+    
+    // Capacity in sectors (64-bit config field read as two words)
+    uint32_t cap_lo = VIRTIO_REG(d, VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CFG_CAPACITY);
+    uint32_t cap_hi = VIRTIO_REG(d, VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CFG_CAPACITY + 4);
+    d->capacity = ((uint64_t)cap_hi << 32) | cap_lo;
+    
+    status |= VIRTIO_STATUS_DRIVER_OK;
+    VIRTIO_REG(d, VIRTIO_MMIO_STATUS) = status;
+    
+    irq_register(irq, virtio_blk_intr, d);
+    return 0;
+}
+
+// Probe the virtio-mmio slots for block devices. Done on first use of the
+// disk rather than at boot, since booting from the initramfs needs no disk.
+int vblk_probed = 0;
+
+void virtio_blk_init(void) {
+    if (vblk_probed) return;
+    vblk_probed = 1;
+    vblk_count = 0;
+    for (int slot = 0; slot < VIRTIO_MMIO_SLOTS && vblk_count < VIRTIO_BLK_MAX; slot++) {
+        unsigned long base = VIRTIO_MMIO_BASE + slot * VIRTIO_MMIO_STRIDE;
+        if (REG32(base + VIRTIO_MMIO_MAGIC_VALUE) != VIRTIO_MAGIC) continue;
+        if (REG32(base + VIRTIO_MMIO_DEVICE_ID) != VIRTIO_DEV_BLK) continue;
+        
+        if (REG32(base + VIRTIO_MMIO_VERSION) != 2) {
+            printf("virtio: slot %d is a legacy device, run QEMU with "
+                   "-global virtio-mmio.force-legacy=false\n", slot, 0, 0, 0, 0, 0);
+            continue;
+        }
+        
+        virtio_blk_t* d = &vblk[vblk_count];
+        if (virtio_blk_setup(d, base, VIRTIO_MMIO_IRQ(slot)) != 0) {
+            printf("virtio: slot %d: block device setup failed\n", slot, 0, 0, 0, 0, 0);
+            continue;
+        }
+        printf("virtio-blk%d: %d KB, event_idx=%d%s\n", vblk_count,
+               (long)(d->capacity / 2), d->event_idx, (long)(d->read_only ? ", read-only" : ""), 0, 0);
+        vblk_count++;
+    }
+}
+
+// Phase 21: Block Buffer Cache
+//
+// Blocks are cached by (device, block) in page-sized buffers drawn from the
+// page allocator, found through a hash table and recycled in LRU order.
+// Sequential reads trigger asynchronous read-ahead; writes only dirty the
+// buffer, and write-back later sends runs of adjacent dirty blocks to the
+// device as one scatter-gather request. All cache state is touched only
+// from thread context: completions are noted by the driver and reaped here.
+#define BCACHE_BLOCK_SIZE PAGE_SIZE
+#define BCACHE_SECTORS (BCACHE_BLOCK_SIZE / VIRTIO_BLK_SECTOR_SIZE)
+#define BCACHE_MAX_BUFS 256     // 1MB of cached blocks
+#define BCACHE_HASH 64
+#define BCACHE_MAX_IO 6         // Requests in flight (6 * 18 descriptors fits the queue)
+#define BCACHE_READAHEAD 8      // Blocks read ahead of a sequential reader
+#define BCACHE_WB_INTERVAL (TIMER_HZ / 2)  // How often background write-back runs
+#define BCACHE_WB_AGE TIMER_HZ  // Dirty blocks older than this get written
+
+#define BUF_VALID 0x1           // Data matches (or supersedes) the disk
+#define BUF_DIRTY 0x2           // Must be written back before eviction
+#define BUF_IO    0x4           // A read or write is in flight
+#define BUF_RA    0x8           // Brought in by read-ahead, not yet used
+
+typedef struct buf {
+    int dev;
+    uint32_t block;
+    int flags;                  // BUF_*
+    int refcnt;
+    long dirty_tick;            // When it was first dirtied
+    char* data;                 // BCACHE_BLOCK_SIZE bytes
+    struct buf* hash_next;
+    struct buf* lru_prev;       // Toward most recently used
+    struct buf* lru_next;       // Toward least recently used
+} buf_t;
+
+// One device request covering a run of adjacent buffers
+typedef struct {
+    blk_req_t req;
+    int dev;
+    int in_use;
+    int nbufs;
+    buf_t* bufs[BLK_MAX_SEGS];
+} bcache_io_t;
+
+buf_t bcache_bufs[BCACHE_MAX_BUFS];
+int bcache_nbufs = 0;           // Buffers that have a data page
+buf_t* bcache_hash[BCACHE_HASH];
+buf_t* bcache_lru_head = 0;     // Most recently used
+buf_t* bcache_lru_tail = 0;     // Least recently used
+bcache_io_t bcache_io[BCACHE_MAX_IO];
+uint32_t bcache_last_block[VIRTIO_BLK_MAX];  // Sequential-read detection
+uint32_t bcache_ra_next[VIRTIO_BLK_MAX];     // First block not yet read ahead
+long bcache_next_wb = 0;        // Tick of the next background write-back
+
+// Statistics
+long bcache_hits = 0;
+long bcache_misses = 0;
+long bcache_evictions = 0;
+long bcache_ra_blocks = 0;
+long bcache_ra_hits = 0;
+long bcache_wb_requests = 0;
+long bcache_wb_blocks = 0;
+long bcache_io_errors = 0;      // Requests that failed or were refused
+
+static inline int bcache_hashfn(int dev, uint32_t block) {
+    return (int)((block * 31 + (uint32_t)dev) % BCACHE_HASH);
+}
+
+uint32_t bcache_dev_blocks(int dev) {
+    return (uint32_t)(vblk[dev].capacity / BCACHE_SECTORS);
+}
+
+buf_t* bcache_lookup(int dev, uint32_t block) {
+    for (buf_t* b = bcache_hash[bcache_hashfn(dev, block)]; b; b = b->hash_next) {
+        if (b->dev == dev && b->block == block) return b;
+    }
+    return 0;
+}
+
+void bcache_hash_remove(buf_t* b) {
+    buf_t** pp = &bcache_hash[bcache_hashfn(b->dev, b->block)];
+    while (*pp) {
+        if (*pp == b) {
+            *pp = b->hash_next;
+            return;
+        }
+        pp = &(*pp)->hash_next;
+    }
+}
+
+void bcache_lru_remove(buf_t* b) {
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else bcache_lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else bcache_lru_tail = b->lru_prev;
+}
+
+// Insert a buffer at the most recently used end
+void bcache_lru_push(buf_t* b) {
+    b->lru_prev = 0;
+    b->lru_next = bcache_lru_head;
+    if (bcache_lru_head) bcache_lru_head->lru_prev = b;
+    bcache_lru_head = b;
+    if (!bcache_lru_tail) bcache_lru_tail = b;
+}
+
+// Move a buffer to the most recently used end
+void bcache_lru_touch(buf_t* b) {
+    if (bcache_lru_head == b) return;
+    bcache_lru_remove(b);
+    bcache_lru_push(b);
+}
+
+// Apply finished requests to their buffers
+void bcache_reap(void) {
+    for (int i = 0; i < BCACHE_MAX_IO; i++) {
+        bcache_io_t* io = &bcache_io[i];
+        if (!io->in_use || !io->req.done) continue;
+        
+        int ok = io->req.status == VIRTIO_BLK_S_OK;
+        if (!ok) bcache_io_errors++;
+        for (int k = 0; k < io->nbufs; k++) {
+            buf_t* b = io->bufs[k];
+            b->flags &= ~BUF_IO;
+            if (io->req.op == VIRTIO_BLK_T_IN) {
+                if (ok) b->flags |= BUF_VALID;
+                else b->flags &= ~(BUF_VALID | BUF_RA);
+            } else if (!ok) {
+                b->flags |= BUF_DIRTY;  // Retry on the next write-back
+            }
+        }
+        io->in_use = 0;
+    }
+}
+
+// Wait for any in-flight request to finish
+void bcache_wait_any(void) {
+    for (int i = 0; i < BCACHE_MAX_IO; i++) {
+        bcache_io_t* io = &bcache_io[i];
+        if (io->in_use && io->req.nseg > 0 && !io->req.done) {
+            virtio_blk_kick(io->dev);
+            virtio_blk_wait(io->dev, &io->req);
+            break;
+        }
+    }
+    bcache_reap();
+}
+
+// Get a free request slot; waits for one if `wait`, else may return NULL
+bcache_io_t* bcache_io_get(int dev, int op, uint32_t block, int wait) {
+    while (1) {
+        bcache_reap();
+        for (int i = 0; i < BCACHE_MAX_IO; i++) {
+            bcache_io_t* io = &bcache_io[i];
+            if (io->in_use) continue;
+            io->in_use = 1;
+            io->dev = dev;
+            io->nbufs = 0;
+            io->req.op = op;
+            io->req.sector = (uint64_t)block * BCACHE_SECTORS;
+            io->req.nseg = 0;
+            io->req.done = 0;
+            io->req.complete = 0;
+            io->req.priv = io;
+            return io;
+        }
+        if (!wait) return 0;
+        bcache_wait_any();
+    }
+}
+
+void bcache_io_add(bcache_io_t* io, buf_t* b) {
+    io->bufs[io->nbufs++] = b;
+    io->req.seg[io->req.nseg].addr = b->data;
+    io->req.seg[io->req.nseg].len = BCACHE_BLOCK_SIZE;
+    io->req.nseg++;
+}
+
+// Queue a request; the caller kicks the device once per batch. A request
+// the device refuses outright completes at once with an I/O error.
+void bcache_io_submit(bcache_io_t* io) {
+    int rc;
+    while ((rc = virtio_blk_submit(io->dev, &io->req)) != 0) {
+        if (rc != -1) {
+            io->req.status = VIRTIO_BLK_S_IOERR;
+            io->req.done = 1;
+            return;
+        }
+        virtio_blk_kick(io->dev);
+        virtio_blk_idle(io->dev, vblk[io->dev].completed);  // Queue full
+    }
+}
+
+// Write back dirty buffers (all of them, or only those older than
+// BCACHE_WB_AGE), merging runs of adjacent blocks into single requests
+void bcache_writeback(int all) {
+    static buf_t* list[BCACHE_MAX_BUFS];
+    int n = 0;
+    
+    bcache_reap();
+    for (int i = 0; i < bcache_nbufs; i++) {
+        buf_t* b = &bcache_bufs[i];
+        if ((b->flags & (BUF_DIRTY | BUF_IO)) != BUF_DIRTY) continue;
+        if (!all && ticks - b->dirty_tick < BCACHE_WB_AGE) continue;
+        list[n++] = b;
+    }
+    if (n == 0) return;
+    
+    // Sort by (device, block) so adjacent blocks end up next to each other
+    for (int i = 1; i < n; i++) {
+        buf_t* b = list[i];
+        int j = i - 1;
+        while (j >= 0 && (list[j]->dev > b->dev ||
+                          (list[j]->dev == b->dev && list[j]->block > b->block))) {
+            list[j + 1] = list[j];
+            j--;
+        }
+        list[j + 1] = b;
+    }
+    
+    bcache_io_t* io = 0;
+    for (int i = 0; i < n; i++) {
+        buf_t* b = list[i];
+        if (io && (b->dev != io->dev || b->block != io->bufs[io->nbufs - 1]->block + 1 ||
+                   io->nbufs == BLK_MAX_SEGS)) {
+            bcache_io_submit(io);
+            io = 0;
+        }
+        if (!io) {
+            io = bcache_io_get(b->dev, VIRTIO_BLK_T_OUT, b->block, 1);
+            bcache_wb_requests++;
+        }
+        b->flags = (b->flags & ~BUF_DIRTY) | BUF_IO;
+        bcache_io_add(io, b);
+        bcache_wb_blocks++;
+    }
+    if (io) bcache_io_submit(io);
+    
+    for (int dev = 0; dev < vblk_count; dev++) {
+        virtio_blk_kick(dev);
+    }
+}
+
+// Find a buffer to hold (dev, block). Takes a fresh page while the cache is
+// below its limit, otherwise evicts the least recently used clean buffer.
+// Only waits (for write-back) if `wait` is set.
+buf_t* bcache_alloc(int dev, uint32_t block, int wait) {
+    buf_t* b = 0;
+    
+    if (bcache_nbufs < BCACHE_MAX_BUFS) {
+        char* page = (char*)page_alloc();
+        if (page) {
+            b = &bcache_bufs[bcache_nbufs++];
+            b->data = page;
+            bcache_lru_push(b);
+        }
+    }
+    
+    while (!b) {
+        bcache_reap();
+        for (buf_t* x = bcache_lru_tail; x; x = x->lru_prev) {
+            if (x->refcnt == 0 && !(x->flags & (BUF_DIRTY | BUF_IO))) {
+                b = x;
+                break;
+            }
+        }
+        if (b) {
+            bcache_hash_remove(b);
+            bcache_evictions++;
+            break;
+        }
+        if (!wait) return 0;
+        
+        // Everything is dirty, busy or pinned: clean some buffers and retry
+        bcache_writeback(1);
+        int busy = 0;
+        for (int i = 0; i < BCACHE_MAX_IO; i++) busy |= bcache_io[i].in_use;
+        if (!busy) return 0;  // All pinned
+        bcache_wait_any();
+    }
+    
+    b->dev = dev;
+    b->block = block;
+    b->flags = 0;
+    b->refcnt = 0;
+    int h = bcache_hashfn(dev, block);
+    b->hash_next = bcache_hash[h];
+    bcache_hash[h] = b;
+    return b;
+}
+
+// Start reading `demand` (if given, for block `start`) plus up to `count`
+// read-ahead blocks after it, batching adjacent uncached blocks per request
+void bcache_fetch(int dev, buf_t* demand, uint32_t start, int count) {
+    uint32_t limit = bcache_dev_blocks(dev);
+    uint32_t end = start + count + (demand ? 1 : 0);
+    bcache_io_t* io = 0;
+    
+    for (uint32_t blk = start; blk < end && blk < limit; blk++) {
+        buf_t* b = demand;
+        if (!demand || blk != start) {
+            b = bcache_lookup(dev, blk);
+            if (b && (b->flags & (BUF_VALID | BUF_IO))) {
+                // Already cached or on its way: end the current run here
+                if (io) bcache_io_submit(io);
+                io = 0;
+                continue;
+            }
+            if (!b) b = bcache_alloc(dev, blk, 0);
+            if (!b) break;
+        }
+        if (!io) {
+            io = bcache_io_get(dev, VIRTIO_BLK_T_IN, blk, b == demand);
+            if (!io) break;
+        }
+        b->flags = (b->flags & ~BUF_RA) | BUF_IO;
+        if (b != demand) {
+            b->flags |= BUF_RA;
+            bcache_ra_blocks++;
+        }
+        bcache_io_add(io, b);
+        if (io->nbufs == BLK_MAX_SEGS) {
+            bcache_io_submit(io);
+            io = 0;
+        }
+    }
+    if (io) bcache_io_submit(io);
+    virtio_blk_kick(dev);
+}
+
+void bcache_wait_buf(buf_t* b) {
+    while (b->flags & BUF_IO) {
+        long seen = vblk[b->dev].completed;
+        bcache_reap();
+        if (!(b->flags & BUF_IO)) break;
+        virtio_blk_kick(b->dev);
+        virtio_blk_idle(b->dev, seen);
+    }
+}
+
+// Return a referenced buffer holding (dev, block), or NULL on I/O error
+buf_t* bread(int dev, uint32_t block) {
+    if (dev < 0 || dev >= vblk_count || block >= bcache_dev_blocks(dev)) return 0;
+    bcache_reap();
+    
+    // A stream is sequential if it continues from the last sequential or
+    // missed block; hits elsewhere (e.g. a cached inode block) don't break it
+    buf_t* b = bcache_lookup(dev, block);
+    int hit = b && (b->flags & (BUF_VALID | BUF_IO));
+    int seq = (block == bcache_last_block[dev] + 1);
+    if (seq || !hit) bcache_last_block[dev] = block;
+    
+    if (hit) {
+        bcache_hits++;
+        if (b->flags & BUF_RA) {
+            bcache_ra_hits++;
+            b->flags &= ~BUF_RA;
+        }
+        b->refcnt++;
+    } else {
+        bcache_misses++;
+        if (!b) b = bcache_alloc(dev, block, 1);
+        if (!b) return 0;
+        b->refcnt++;
+        bcache_fetch(dev, b, block, seq ? BCACHE_READAHEAD : 0);
+        if (seq) bcache_ra_next[dev] = block + 1 + BCACHE_READAHEAD;
+    }
+    
+    // Keep the read-ahead window ahead of a sequential reader
+    if (seq && block + BCACHE_READAHEAD / 2 >= bcache_ra_next[dev]) {
+        uint32_t start = bcache_ra_next[dev] > block ? bcache_ra_next[dev] : block + 1;
+        bcache_fetch(dev, 0, start, BCACHE_READAHEAD);
+        bcache_ra_next[dev] = start + BCACHE_READAHEAD;
+    }
+    
+    bcache_wait_buf(b);
+    if (!(b->flags & BUF_VALID)) {
+        b->refcnt--;
+        return 0;
+    }
+    bcache_lru_touch(b);
+    return b;
+}
+
+// Like bread() for a block the caller will overwrite entirely: no disk read
+buf_t* bgetz(int dev, uint32_t block) {
+    if (dev < 0 || dev >= vblk_count || block >= bcache_dev_blocks(dev)) return 0;
+    
+    buf_t* b = bcache_lookup(dev, block);
+    if (!b) b = bcache_alloc(dev, block, 1);
+    if (!b) return 0;
+    b->refcnt++;
+    bcache_wait_buf(b);
+    memset(b->data, 0, BCACHE_BLOCK_SIZE);
+    b->flags = (b->flags & ~BUF_RA) | BUF_VALID;
+    bcache_lru_touch(b);
+    return b;
+}
+
+// Mark a referenced buffer as modified; it is written back later
+void bdirty(buf_t* b) {
+    if (!(b->flags & BUF_DIRTY)) {
+        b->flags |= BUF_DIRTY;
+        b->dirty_tick = ticks;
+    }
+}
+
+void brelse(buf_t* b) {
+    if (b && b->refcnt > 0) b->refcnt--;
+}
+
+// Run background write-back if it is due
+void bcache_background(void) {
+    if (ticks < bcache_next_wb) return;
+    bcache_next_wb = ticks + BCACHE_WB_INTERVAL;
+    bcache_writeback(0);
+}
+
+// Write back everything, wait for it, and flush the device caches.
+// Returns 0, or -1 if a write or flush failed (failed blocks stay dirty).
+int bcache_sync(void) {
+    long errors = bcache_io_errors;
+    int ret = 0;
+    bcache_writeback(1);
+    for (int i = 0; i < BCACHE_MAX_IO; i++) {
+        while (bcache_io[i].in_use) bcache_wait_any();
+    }
+    for (int dev = 0; dev < vblk_count; dev++) {
+        if (!vblk[dev].read_only && virtio_blk_flush(dev) != 0) ret = -1;
+    }
+    return bcache_io_errors != errors ? -1 : ret;
+}
+
+// Drop clean, unreferenced blocks of `dev` so the next reads go to the disk
+void bcache_invalidate(int dev) {
+    bcache_reap();
+    for (int i = 0; i < bcache_nbufs; i++) {
+        buf_t* b = &bcache_bufs[i];
+        if (b->dev != dev || b->refcnt > 0 || (b->flags & (BUF_DIRTY | BUF_IO))) continue;
+        bcache_hash_remove(b);
+        b->dev = -1;
+        b->flags = 0;
+    }
+    bcache_last_block[dev] = (uint32_t)-1;
+}
+
+int bcache_dirty_count(void) {
+    int n = 0;
+    for (int i = 0; i < bcache_nbufs; i++) {
+        if (bcache_bufs[i].flags & BUF_DIRTY) n++;
+    }
+    return n;
+}
+
+void bcache_init(void) {
+    for (int dev = 0; dev < VIRTIO_BLK_MAX; dev++) {
+        bcache_last_block[dev] = (uint32_t)-1;
+        bcache_ra_next[dev] = 0;
+    }
+}
+
+// Kernel thread: periodic write-back of dirty buffers
+void kflushd(void* arg) {
+    (void)arg;
+    for (;;) {
+        bcache_background();
+        kthread_sleep(BCACHE_WB_INTERVAL);
+    }
+}
+
+// Phase 6: File System (vibefs, see vibefs.h)
+//
+// A flat, extent-based filesystem on block device 0. All metadata goes
+// through the buffer cache; the superblock and root inode are kept in memory.
+#define FS_BS VIBEFS_BLOCK_SIZE
+
+struct vibefs_super fs_sb;
+struct vibefs_inode fs_root;    // Root directory inode (its extents never change)
+int fs_mounted = 0;
+int fs_read_only = 0;           // Mounted from a read-only disk
+int fs_dev = 0;
+uint32_t fs_alloc_hint = 0;     // Where the next block search starts
+uint32_t fs_ino_hint = VIBEFS_ROOT_INO + 1;
+long fs_free_blocks = 0;
+
+// Test, set or clear a block's bit in the bitmap
+#define FS_BIT_TEST  0
+#define FS_BIT_SET   1
+#define FS_BIT_CLEAR 2
+
+int fs_bitmap(uint32_t block, int op) {
+    buf_t* b = bread(fs_dev, fs_sb.bitmap_start + block / VIBEFS_BITS_PER_BLOCK);
+    if (!b) return -1;
+    uint32_t bit = block % VIBEFS_BITS_PER_BLOCK;
+    unsigned char* byte = (unsigned char*)b->data + bit / 8;
+    unsigned char mask = 1 << (bit % 8);
+    int was = (*byte & mask) != 0;
+    if (op == FS_BIT_SET && !was) {
+        *byte |= mask;
+        fs_free_blocks--;
+        bdirty(b);
+    } else if (op == FS_BIT_CLEAR && was) {
+        *byte &= ~mask;
+        fs_free_blocks++;
+        bdirty(b);
+    }
+    brelse(b);
+    return was;
+}
+
+// First free block at or after `from` (wrapping around), or 0 if the disk is full
+uint32_t fs_find_free(uint32_t from) {
+    uint32_t total = fs_sb.block_count;
+    if (from < fs_sb.data_start || from >= total) from = fs_sb.data_start;
+    
+    uint32_t block = from;
+    for (uint32_t scanned = 0; scanned < total; ) {
+        buf_t* b = bread(fs_dev, fs_sb.bitmap_start + block / VIBEFS_BITS_PER_BLOCK);
+        if (!b) return 0;
+        unsigned char* bits = (unsigned char*)b->data;
+        uint32_t base = block - block % VIBEFS_BITS_PER_BLOCK;
+        uint32_t bit = block % VIBEFS_BITS_PER_BLOCK;
+        while (bit < VIBEFS_BITS_PER_BLOCK && base + bit < total) {
+            if (bit % 8 == 0 && bits[bit / 8] == 0xff) {
+                bit += 8;  // Skip full bytes
+                continue;
+            }
+            if (!(bits[bit / 8] & (1 << (bit % 8))) && base + bit >= fs_sb.data_start) {
+                brelse(b);
+                return base + bit;
+            }
+            bit++;
+        }
+        brelse(b);
+        scanned += base + bit - block;
+        block = base + bit;
+        if (block >= total) block = fs_sb.data_start;
+    }
+    return 0;
+}
+
+// Allocate up to `want` contiguous blocks, starting at `goal` if it is free.
+// Returns the first block and sets *got, or returns 0 if the disk is full.
+uint32_t fs_balloc(uint32_t goal, uint32_t want, uint32_t* got) {
+    uint32_t start = 0;
+    if (goal >= fs_sb.data_start && goal < fs_sb.block_count && fs_bitmap(goal, FS_BIT_TEST) == 0) {
+        start = goal;
+    } else {
+        start = fs_find_free(fs_alloc_hint);
+    }
+    if (start == 0) return 0;
+    
+    uint32_t n = 0;
+    while (n < want && start + n < fs_sb.block_count && fs_bitmap(start + n, FS_BIT_SET) == 0) {
+        n++;
+    }
+    fs_alloc_hint = start + n;
+    *got = n;
+    return n ? start : 0;
+}
+
+// Inode `ino`, inside referenced buffer *bp (caller releases it)
+struct vibefs_inode* fs_iget(uint32_t ino, buf_t** bp) {
+    if (ino == 0 || ino >= fs_sb.inode_count) return 0;
+    buf_t* b = bread(fs_dev, fs_sb.inode_start + ino / VIBEFS_INODES_PER_BLOCK);
+    if (!b) return 0;
+    *bp = b;
+    return (struct vibefs_inode*)b->data + ino % VIBEFS_INODES_PER_BLOCK;
+}
+
+// Disk block holding file block `fblock`, or 0 if beyond the allocation
+uint32_t fs_bmap(struct vibefs_inode* ip, uint32_t fblock) {
+    for (uint32_t i = 0; i < ip->nextents; i++) {
+        if (fblock < ip->ext[i].len) return ip->ext[i].start + fblock;
+        fblock -= ip->ext[i].len;
+    }
+    return 0;
+}
+
+uint32_t fs_nblocks(struct vibefs_inode* ip) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < ip->nextents; i++) n += ip->ext[i].len;
+    return n;
+}
+
+// Make sure the file has blocks for `size` bytes, growing the last extent in place when possible
+int fs_reserve(struct vibefs_inode* ip, uint64_t size) {
+    uint32_t need = (uint32_t)((size + FS_BS - 1) / FS_BS);
+    uint32_t have = fs_nblocks(ip);
+    
+    while (have < need) {
+        struct vibefs_extent* last = ip->nextents ? &ip->ext[ip->nextents - 1] : 0;
+        uint32_t got = 0;
+        uint32_t start = fs_balloc(last ? last->start + last->len : fs_alloc_hint, need - have, &got);
+        if (start == 0) return -1;  // Disk full
+        
+        if (last && last->start + last->len == start) {
+            last->len += got;
+        } else if (ip->nextents < VIBEFS_NEXTENTS) {
+            ip->ext[ip->nextents].start = start;
+            ip->ext[ip->nextents].len = got;
+            ip->nextents++;
+        } else {
+            // Too fragmented for the extent list
+            for (uint32_t i = 0; i < got; i++) fs_bitmap(start + i, FS_BIT_CLEAR);
+            return -1;
+        }
+        have += got;
+    }
+    return 0;
+}
+
+// Free all of a file's blocks
+void fs_truncate(struct vibefs_inode* ip) {
+    for (uint32_t i = 0; i < ip->nextents; i++) {
+        for (uint32_t k = 0; k < ip->ext[i].len; k++) {
+            fs_bitmap(ip->ext[i].start + k, FS_BIT_CLEAR);
+        }
+        if (ip->ext[i].start < fs_alloc_hint) fs_alloc_hint = ip->ext[i].start;
+    }
+    ip->nextents = 0;
+    ip->size = 0;
+}
+
+// Read up to n bytes at `off`; returns bytes read or -1 on error
+long fs_read(uint32_t ino, uint64_t off, void* dst, long n) {
+    buf_t* ib;
+    struct vibefs_inode* ip = fs_iget(ino, &ib);
+    if (!ip) return -1;
+    struct vibefs_inode in = *ip;  // Don't pin the inode block during the copy
+    brelse(ib);
+    
+    if (off >= in.size) return 0;
+    if (off + n > in.size) n = (long)(in.size - off);
+    
+    long done = 0;
+    while (done < n) {
+        uint64_t pos = off + done;
+        long boff = (long)(pos % FS_BS);
+        long chunk = FS_BS - boff;
+        if (chunk > n - done) chunk = n - done;
+        
+        uint32_t blk = fs_bmap(&in, (uint32_t)(pos / FS_BS));
+        buf_t* b = blk ? bread(fs_dev, blk) : 0;
+        if (!b) return done ? done : -1;
+        memcpy((char*)dst + done, b->data + boff, chunk);
+        brelse(b);
+        done += chunk;
+    }
+    return done;
+}
+
+// Write n bytes at `off`, growing the file; returns bytes written or -1
+long fs_write(uint32_t ino, uint64_t off, const void* src, long n) {
+    if (fs_read_only) return -1;
+    buf_t* ib;
+    struct vibefs_inode* ip = fs_iget(ino, &ib);
+    if (!ip) return -1;
+    if (ip->type != VIBEFS_T_FILE) {
+        brelse(ib);
+        return -1;
+    }
+    
+    uint32_t old_blocks = fs_nblocks(ip);
+    if (fs_reserve(ip, off + n) != 0) {
+        bdirty(ib);  // Keep whatever was allocated before running out
+        brelse(ib);
+        return -1;
+    }
+    
+    // Zero the gap between the old end of file and `off`: its blocks may
+    // still hold a deleted file's data, which fs_read would hand back
+    for (uint64_t pos = ip->size; pos < off; ) {
+        uint32_t fblock = (uint32_t)(pos / FS_BS);
+        long boff = (long)(pos % FS_BS);
+        long chunk = FS_BS - boff;
+        if ((uint64_t)chunk > off - pos) chunk = (long)(off - pos);
+        
+        uint32_t blk = fs_bmap(ip, fblock);
+        buf_t* b = fblock >= old_blocks ? bgetz(fs_dev, blk) : bread(fs_dev, blk);
+        if (!b) {
+            bdirty(ib);
+            brelse(ib);
+            return -1;
+        }
+        memset(b->data + boff, 0, chunk);
+        bdirty(b);
+        brelse(b);
+        pos += chunk;
+    }
+    
+    long done = 0;
+    while (done < n) {
+        uint64_t pos = off + done;
+        uint32_t fblock = (uint32_t)(pos / FS_BS);
+        long boff = (long)(pos % FS_BS);
+        long chunk = FS_BS - boff;
+        if (chunk > n - done) chunk = n - done;
+        
+        // Whole blocks and freshly allocated blocks don't need to be read first
+        uint32_t blk = fs_bmap(ip, fblock);
+        buf_t* b = (chunk == FS_BS || fblock >= old_blocks) ? bgetz(fs_dev, blk) : bread(fs_dev, blk);
+        if (!b) break;
+        memcpy(b->data + boff, (const char*)src + done, chunk);
+        bdirty(b);
+        brelse(b);
+        done += chunk;
+    }
+    
+    if (off + done > ip->size) ip->size = off + done;
+    ip->mtime = rtc_seconds();
+    bdirty(ib);
+    brelse(ib);
+    return done ? done : (n ? -1 : 0);
+}
+
+// Root directory slot `slot`, inside referenced buffer *bp
+struct vibefs_dirent* fs_dirent(uint32_t slot, buf_t** bp) {
+    uint32_t blk = fs_bmap(&fs_root, slot / VIBEFS_DIRENTS_PER_BLOCK);
+    buf_t* b = blk ? bread(fs_dev, blk) : 0;
+    if (!b) return 0;
+    *bp = b;
+    return (struct vibefs_dirent*)b->data + slot % VIBEFS_DIRENTS_PER_BLOCK;
+}
+
+uint32_t fs_dir_slots(void) {
+    return (uint32_t)(fs_root.size / sizeof(struct vibefs_dirent));
+}
+
+// Probe the root directory's hash table for `name`. Returns its slot or -1;
+// *free_slot gets the first reusable slot on the probe path (or -1).
+long fs_dir_find(const char* name, long* free_slot) {
+    uint32_t hash = vibefs_hash(name);
+    uint32_t nslots = fs_dir_slots();
+    *free_slot = -1;
+    
+    for (uint32_t i = 0; i < nslots; i++) {
+        uint32_t slot = (hash + i) % nslots;
+        buf_t* b;
+        struct vibefs_dirent* de = fs_dirent(slot, &b);
+        if (!de) return -1;
+        int state = de->state;
+        int match = state == VIBEFS_DE_USED && de->hash == hash && strcmp(de->name, name) == 0;
+        brelse(b);
+        
+        if (match) return slot;
+        if (state != VIBEFS_DE_USED && *free_slot < 0) *free_slot = slot;
+        if (state == VIBEFS_DE_EMPTY) break;
+    }
+    return -1;
+}
+
+// Strip a leading '/' and check the name fits a directory entry
+const char* fs_name(const char* path) {
+    if (*path == '/') path++;
+    long len = strlen(path);
+    if (len == 0 || len > VIBEFS_NAME_MAX) return 0;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/') return 0;
+    }
+    return path;
+}
+
+// Inode number of `path`, or 0 if it doesn't exist
+uint32_t fs_lookup(const char* path) {
+    const char* name = fs_name(path);
+    if (!fs_mounted || !name) return 0;
+    long free_slot;
+    long slot = fs_dir_find(name, &free_slot);
+    if (slot < 0) return 0;
+    buf_t* b;
+    struct vibefs_dirent* de = fs_dirent(slot, &b);
+    uint32_t ino = de ? de->ino : 0;
+    if (de) brelse(b);
+    return ino;
+}
+
+// Create an empty file (or empty an existing one); returns its inode or 0
+uint32_t fs_create(const char* path) {
+    const char* name = fs_name(path);
+    if (!fs_mounted || fs_read_only || !name) return 0;
+    
+    long free_slot;
+    long slot = fs_dir_find(name, &free_slot);
+    if (slot >= 0) {
+        uint32_t ino = fs_lookup(name);
+        buf_t* ib;
+        struct vibefs_inode* ip = fs_iget(ino, &ib);
+        if (!ip) return 0;
+        if (ip->type != VIBEFS_T_FILE) {
+            brelse(ib);
+            return 0;
+        }
+        fs_truncate(ip);
+        ip->mtime = rtc_seconds();
+        bdirty(ib);
+        brelse(ib);
+        return ino;
+    }
+    if (free_slot < 0) return 0;  // Directory full
+    
+    // Find a free inode, starting from the hint and wrapping past the root
+    uint32_t first = VIBEFS_ROOT_INO + 1;
+    uint32_t span = fs_sb.inode_count - first;
+    if (fs_ino_hint < first || fs_ino_hint >= fs_sb.inode_count) fs_ino_hint = first;
+    uint32_t ino = 0;
+    for (uint32_t i = 0; i < span && !ino; i++) {
+        uint32_t cand = first + (fs_ino_hint - first + i) % span;
+        buf_t* ib;
+        struct vibefs_inode* ip = fs_iget(cand, &ib);
+        if (!ip) return 0;
+        if (ip->type == VIBEFS_T_FREE) {
+            memset(ip, 0, sizeof(*ip));
+            ip->type = VIBEFS_T_FILE;
+            ip->nlink = 1;
+            ip->mtime = rtc_seconds();
+            bdirty(ib);
+            ino = cand;
+            fs_ino_hint = cand + 1;
+        }
+        brelse(ib);
+    }
+    if (!ino) return 0;
+    
+    buf_t* b;
+    struct vibefs_dirent* de = fs_dirent(free_slot, &b);
+    if (!de) return 0;
+    de->ino = ino;
+    de->hash = vibefs_hash(name);
+    de->state = VIBEFS_DE_USED;
+    de->name_len = (uint8_t)strlen(name);
+    strcpy(de->name, name);
+    bdirty(b);
+    brelse(b);
+    return ino;
+}
+
+// Remove a file; returns 0 on success
+int fs_unlink(const char* path) {
+    const char* name = fs_name(path);
+    if (!fs_mounted || fs_read_only || !name) return -1;
+    long free_slot;
+    long slot = fs_dir_find(name, &free_slot);
+    if (slot < 0) return -1;
+    
+    buf_t* b;
+    struct vibefs_dirent* de = fs_dirent(slot, &b);
+    if (!de) return -1;
+    uint32_t ino = de->ino;
+    de->state = VIBEFS_DE_DELETED;  // Tombstone keeps later probe chains intact
+    bdirty(b);
+    brelse(b);
+    
+    buf_t* ib;
+    struct vibefs_inode* ip = fs_iget(ino, &ib);
+    if (!ip) return -1;
+    fs_truncate(ip);
+    ip->type = VIBEFS_T_FREE;
+    ip->nlink = 0;
+    bdirty(ib);
+    brelse(ib);
+    if (ino < fs_ino_hint) fs_ino_hint = ino;
+    return 0;
+}
+
+// Mount the filesystem on block device `dev`; returns 0 on success
+int fs_mount(int dev) {
+    fs_mounted = 0;
+    buf_t* b = bread(dev, 0);
+    if (!b) return -1;
+    memcpy(&fs_sb, b->data, sizeof(fs_sb));
+    brelse(b);
+    if (fs_sb.magic != VIBEFS_MAGIC || fs_sb.version != VIBEFS_VERSION) return -1;
+    fs_dev = dev;
+    
+    buf_t* ib;
+    struct vibefs_inode* ip = fs_iget(fs_sb.root_ino, &ib);
+    if (!ip) return -1;
+    fs_root = *ip;
+    brelse(ib);
+    if (fs_root.type != VIBEFS_T_DIR) return -1;
+    
+    // Count free blocks once; allocation keeps the count current
+    fs_free_blocks = 0;
+    for (uint32_t i = 0; i < fs_sb.bitmap_blocks; i++) {
+        buf_t* bb = bread(dev, fs_sb.bitmap_start + i);
+        if (!bb) return -1;
+        for (uint32_t bit = 0; bit < VIBEFS_BITS_PER_BLOCK; bit++) {
+            uint32_t block = i * VIBEFS_BITS_PER_BLOCK + bit;
+            if (block >= fs_sb.block_count) break;
+            if (!(((unsigned char*)bb->data)[bit / 8] & (1 << (bit % 8)))) fs_free_blocks++;
+        }
+        brelse(bb);
+    }
+    fs_alloc_hint = fs_sb.data_start;
+    fs_read_only = vblk[dev].read_only;
+    fs_mounted = 1;
+    return 0;
+}
+
+// Mount disk 0 the first time something needs a file, keeping block I/O off the boot path
+int fs_mount_tried = 0;
+
+int fs_ready(void) {
+    virtio_blk_init();
+    if (!fs_mounted && !fs_mount_tried && vblk_count > 0) {
+        fs_mount_tried = 1;
+        if (fs_mount(0) == 0) {
+            printf("vibefs: %d blocks, %d free%s\n", fs_sb.block_count, fs_free_blocks,
+                   (long)(fs_read_only ? ", read-only" : ""), 0, 0, 0);
+        } else {
+            puts_ln("vibefs: no filesystem on disk 0");
+        }
+    }
+    return fs_mounted;
+}
+
+// Boot Archive (initramfs, see initramfs.h)
+//
+// The archive is part of kernel.elf, so it is already in memory at boot:
+// the index is searched in place and file data is handed out as pointers
+// into the image, with no copying and no block I/O. Files appear read-only
+// under /initrd/.
+#define INITRD_PREFIX "/initrd/"
+
+extern char _initramfs_start[];
+extern char _initramfs_end[];
+
+const struct initramfs_header* initrd = 0;  // NULL if there is no valid archive
+
+// Validate the linked-in archive; returns 0 if there is one
+int initramfs_init(void) {
+    long len = _initramfs_end - _initramfs_start;
+    const struct initramfs_header* h = (const struct initramfs_header*)_initramfs_start;
+    if (len < (long)sizeof(*h) || h->magic != INITRAMFS_MAGIC ||
+        h->version != INITRAMFS_VERSION || h->size > len) {
+        return -1;
+    }
+    initrd = h;
+    return 0;
+}
+
+const struct initramfs_entry* initramfs_entries(void) {
+    return (const struct initramfs_entry*)(initrd + 1);
+}
+
+// Binary search of the (sorted) index
+const struct initramfs_entry* initramfs_lookup(const char* name) {
+    if (!initrd) return 0;
+    const struct initramfs_entry* e = initramfs_entries();
+    long lo = 0;
+    long hi = (long)initrd->count - 1;
+    while (lo <= hi) {
+        long mid = (lo + hi) / 2;
+        int cmp = strcmp(name, e[mid].name);
+        if (cmp == 0) return &e[mid];
+        if (cmp < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    return 0;
+}
+
+// A file's data in place inside the kernel image. It starts on a page
+// boundary, so an executable can be mapped from here rather than copied.
+const char* initramfs_map(const struct initramfs_entry* e) {
+    return (const char*)initrd + e->offset;
+}
+
+int is_initrd_path(const char* path) {
+    return strncmp(path, INITRD_PREFIX, sizeof(INITRD_PREFIX) - 1) == 0;
+}
+
+// Entry for an /initrd/ path, or NULL
+const struct initramfs_entry* initrd_lookup(const char* path) {
+    if (!is_initrd_path(path)) return 0;
+    return initramfs_lookup(path + sizeof(INITRD_PREFIX) - 1);
+}
+
+// Inter-Process Communication (shared-memory channels)
+//
+// A channel is a page shared by two processes holding a single-producer,
+// single-consumer ring of message descriptors. Payloads travel by page
+// reference: the producer fills a page and passes its address, the consumer
+// reads it in place and recycles it. Sending and receiving are plain loads
+// and stores on the shared page; the kernel is entered only to sleep on an
+// empty/full ring and to wake a peer that is sleeping.
+//
+// sys_msg_send/sys_msg_recv are the copy-based alternative for comparison:
+// the payload is copied into a kernel buffer and out again.
+#define CHAN_MAX 8
+#define CHAN_SLOTS 64           // Ring entries (power of two)
+
+// Message descriptor
+typedef struct {
+    uint64_t page;              // Payload page; ownership passes to the receiver
+    uint32_t len;
+    uint32_t tag;               // Free for the application
+} chan_msg_t;
+
+// Layout of the shared page. Each side's index sits on its own cache line.
+typedef struct {
+    volatile uint32_t head;     // Next slot to fill (written by the producer)
+    volatile uint32_t consumer_waiting;
+    uint32_t pad0[14];
+    volatile uint32_t tail;     // Next slot to drain (written by the consumer)
+    volatile uint32_t producer_waiting;
+    uint32_t pad1[14];
+    chan_msg_t ring[CHAN_SLOTS];
+} chan_ring_t;
+
+// Kernel side of a channel
+typedef struct {
+    int in_use;
+    int producer_pid;           // -1 for kernel code outside any thread
+    int consumer_pid;
+    chan_ring_t* ring;          // The shared page
+    char* kbuf[CHAN_SLOTS];     // Copy-based path: kernel buffers, allocated on first use
+    uint32_t klen[CHAN_SLOTS];
+    uint32_t khead;
+    uint32_t ktail;
+    long sleeps;                // Kernel entries to sleep
+    long wakeups;               // Kernel entries to wake the peer
+} chan_t;
+
+chan_t chans[CHAN_MAX];
+
+// Set up a channel between two processes (NULL = kernel code outside any
+// thread). Only those two may use the channel's syscalls. Returns the
+// channel id or -1.
+int chan_create(proc_t* producer, proc_t* consumer) {
+    for (int id = 0; id < CHAN_MAX; id++) {
+        chan_t* c = &chans[id];
+        if (c->in_use) continue;
+        c->ring = (chan_ring_t*)page_alloc();
+        if (!c->ring) return -1;
+        c->in_use = 1;
+        c->producer_pid = producer ? producer->pid : -1;
+        c->consumer_pid = consumer ? consumer->pid : -1;
+        c->khead = 0;
+        c->ktail = 0;
+        c->sleeps = 0;
+        c->wakeups = 0;
+        return id;
+    }
+    return -1;
+}
+
+void chan_destroy(int id) {
+    if (id < 0 || id >= CHAN_MAX || !chans[id].in_use) return;
+    chan_t* c = &chans[id];
+    page_free(c->ring);
+    for (int i = 0; i < CHAN_SLOTS; i++) {
+        page_free(c->kbuf[i]);
+        c->kbuf[i] = 0;
+    }
+    c->ring = 0;
+    c->in_use = 0;
+}
+
+// Shared page of a channel (what each endpoint maps)
+chan_ring_t* chan_ring(int id) {
+    if (id < 0 || id >= CHAN_MAX || !chans[id].in_use) return 0;
+    return chans[id].ring;
+}
+
+// Channel `id` if the caller is its producer (or consumer) end, else NULL
+chan_t* chan_endpoint(int id, int producer) {
+    if (id < 0 || id >= CHAN_MAX || !chans[id].in_use) return 0;
+    chan_t* c = &chans[id];
+    int pid = current_proc ? current_proc->pid : -1;
+    return pid == (producer ? c->producer_pid : c->consumer_pid) ? c : 0;
+}
+
+// Syscall: sleep until the ring has room (producer) or messages (consumer).
+// The ring is checked with SIE clear, so a wake can't land between the
+// check and the sleep.
+int sys_chan_wait(int id, int producer) {
+    chan_t* c = chan_endpoint(id, producer);
+    if (!c) return -1;
+    chan_ring_t* r = c->ring;
+    c->sleeps++;
+    long s = intr_off();
+    while (producer ? (r->head - r->tail == CHAN_SLOTS) : (r->head == r->tail)) {
+        proc_sleep(producer ? (void*)&r->tail : (void*)&r->head);
+    }
+    intr_restore(s);
+    return 0;
+}
+
+// Syscall: wake the peer sleeping on the other side of the ring
+int sys_chan_wake(int id, int producer) {
+    chan_t* c = chan_endpoint(id, producer);
+    if (!c) return -1;
+    chan_ring_t* r = c->ring;
+    c->wakeups++;
+    proc_wakeup(producer ? (void*)&r->head : (void*)&r->tail);
+    return 0;
+}
+
+// Producer: queue a payload page (blocks while the ring is full)
+int chan_send(int id, void* page, uint32_t len, uint32_t tag) {
+    chan_ring_t* r = chan_ring(id);
+    if (!r || len > PAGE_SIZE) return -1;
+    
+    while (r->head - r->tail == CHAN_SLOTS) {
+        r->producer_waiting = 1;
+        __sync_synchronize();
+        if (r->head - r->tail != CHAN_SLOTS) {
+            r->producer_waiting = 0;
+            break;
+        }
+        sys_chan_wait(id, 1);
+        r->producer_waiting = 0;
+    }
+    
+    chan_msg_t* m = &r->ring[r->head % CHAN_SLOTS];
+    m->page = (uint64_t)(unsigned long)page;
+    m->len = len;
+    m->tag = tag;
+    __sync_synchronize();  // Publish the descriptor before the index
+    r->head++;
+    __sync_synchronize();
+    if (r->consumer_waiting) sys_chan_wake(id, 1);
+    return 0;
+}
+
+// Consumer: take the next message (blocks while the ring is empty)
+int chan_recv(int id, chan_msg_t* out) {
+    chan_ring_t* r = chan_ring(id);
+    if (!r) return -1;
+    
+    while (r->head == r->tail) {
+        r->consumer_waiting = 1;
+        __sync_synchronize();
+        if (r->head != r->tail) {
+            r->consumer_waiting = 0;
+            break;
+        }
+        sys_chan_wait(id, 0);
+        r->consumer_waiting = 0;
+    }
+    
+    __sync_synchronize();  // Read the descriptor after seeing the index
+    *out = r->ring[r->tail % CHAN_SLOTS];
+    __sync_synchronize();  // Done with the slot before handing it back
+    r->tail++;
+    __sync_synchronize();
+    if (r->producer_waiting) sys_chan_wake(id, 0);
+    return 0;
+}
+
+// Syscall: copy-based send; returns 0, or -1 if the kernel queue is full
+int sys_msg_send(int id, const void* buf, uint32_t len) {
+    chan_t* c = chan_endpoint(id, 1);
+    if (!c || len > PAGE_SIZE) return -1;
+    long flags = irq_save();
+    if (c->khead - c->ktail == CHAN_SLOTS) {
+        irq_restore(flags);
+        return -1;
+    }
+    uint32_t slot = c->khead % CHAN_SLOTS;
+    if (!c->kbuf[slot]) c->kbuf[slot] = (char*)page_alloc();
+    if (!c->kbuf[slot]) {
+        irq_restore(flags);
+        return -1;
+    }
+    memcpy(c->kbuf[slot], buf, len);
+    c->klen[slot] = len;
+    c->khead++;
+    irq_restore(flags);
+    return 0;
+}
+
+// Syscall: copy-based receive; returns the length, or -1 if nothing is queued
+long sys_msg_recv(int id, void* buf, uint32_t max) {
+    chan_t* c = chan_endpoint(id, 0);
+    if (!c) return -1;
+    long flags = irq_save();
+    if (c->khead == c->ktail) {
+        irq_restore(flags);
+        return -1;
+    }
+    uint32_t slot = c->ktail % CHAN_SLOTS;
+    uint32_t len = c->klen[slot] < max ? c->klen[slot] : max;
+    memcpy(buf, c->kbuf[slot], len);
+    c->ktail++;
+    irq_restore(flags);
+    return len;
+}
+
+// Command: help
+void cmd_help(void) {
+    puts_ln("Available commands:");
+    puts_ln("  help     - Show this help message");
+    puts_ln("  echo     - Echo arguments back");
+    puts_ln("  clear    - Clear the screen");
+    puts_ln("  meminfo  - Show memory statistics");
+    puts_ln("  procs    - List active processes");
+    puts_ln("  latency  - Show irqs-off/scheduling latency ('latency reset' clears)");
+    puts_ln("  boottime - Show how long each boot phase took");
+    puts_ln("  blkbench - Block read IOPS/throughput at several queue depths");
+    puts_ln("  sync     - Write back dirty buffers and flush the disk");
+    puts_ln("  ls       - List files");
+    puts_ln("  cat      - Print a file");
+    puts_ln("  write    - Write text to a file: write <file> <text...>");
+    puts_ln("  stat     - Show a file's inode and extents");
+    puts_ln("  cp       - Copy a file: cp <src> <dst>");
+    puts_ln("  rm       - Remove a file");
+    puts_ln("  fsbench  - Filesystem sequential and metadata benchmark");
+    puts_ln("  ipcbench - Zero-copy channel vs copy-based message benchmark");
+    puts_ln("  ctxbench - Voluntary thread yield vs trap-based switch");
+    puts_ln("  mtxbench - Uncontended and contended futex mutex throughput");
+    puts_ln("  sh       - Run a script of shell commands");
+    puts_ln("Files under /initrd/ come from the read-only boot archive.");
+}
+
+// Command: echo
+void cmd_echo(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        // Don't use puts() which adds newline - just print the string
+        for (char* p = argv[i]; *p; p++) {
+            putchar(*p);
+        }
+        if (i < argc - 1) putchar(' ');
+    }
+    putchar('\n');
+}
+
+// Command: clear
+void cmd_clear(void) {
+    puts("\033[2J\033[H");
+}
+
+// Command: meminfo
+void cmd_meminfo(void) {
+    printf("Memory Statistics:\n", 0, 0, 0, 0, 0, 0);
+    printf("  Total Allocated: %x bytes\n", mem_total_allocated, 0, 0, 0, 0, 0);
+    printf("  Total Freed:     %x bytes\n", mem_total_freed, 0, 0, 0, 0, 0);
+    printf("  Current Usage:   %x bytes\n", mem_current_usage, 0, 0, 0, 0, 0);
+    printf("  Peak Usage:      %x bytes\n", mem_peak_usage, 0, 0, 0, 0, 0);
+    printf("  Available:       %x bytes\n", heap_available(), 0, 0, 0, 0, 0);
+    printf("  Total Heap:      %x bytes\n", HEAP_SIZE, 0, 0, 0, 0, 0);
+    printf("  Allocations:     %x\n", mem_num_allocations, 0, 0, 0, 0, 0);
+    printf("  Frees:           %x\n", mem_num_frees, 0, 0, 0, 0, 0);
+    printf("  Pages In Use:    %d (peak %d, %d free)\n", pages_in_use, pages_peak, pages_available(), 0, 0, 0);
+    
+    long lookups = bcache_hits + bcache_misses;
+    printf("Buffer Cache:\n", 0, 0, 0, 0, 0, 0);
+    printf("  Buffers:         %d/%d (%d dirty)\n", bcache_nbufs, BCACHE_MAX_BUFS, bcache_dirty_count(), 0, 0, 0);
+    printf("  Hits/Misses:     %d/%d (%d%% hit rate)\n", bcache_hits, bcache_misses,
+           lookups ? bcache_hits * 100 / lookups : 0, 0, 0, 0);
+    printf("  Evictions:       %d\n", bcache_evictions, 0, 0, 0, 0, 0);
+    printf("  Read-ahead:      %d blocks, %d used\n", bcache_ra_blocks, bcache_ra_hits, 0, 0, 0, 0);
+    printf("  Write-back:      %d blocks in %d requests\n", bcache_wb_blocks, bcache_wb_requests, 0, 0, 0, 0);
+    printf("  I/O errors:      %d\n", bcache_io_errors, 0, 0, 0, 0, 0);
+}
+
+// Command: procs
+void cmd_procs(void) {
+    printf("Process Table:\n", 0, 0, 0, 0, 0, 0);
+    printf("  PID  State        Priority  Name\n", 0, 0, 0, 0, 0, 0);
+    
+    for (int i = 0; i < MAX_PROCS; i++) {
+        if (proc_table[i].state != PROC_UNUSED) {
+            char* state_str = "";
+            switch (proc_table[i].state) {
+                case PROC_READY: state_str = "READY"; break;
+                case PROC_RUNNING: state_str = "RUNNING"; break;
+                case PROC_BLOCKED: state_str = "BLOCKED"; break;
+                case PROC_ZOMBIE: state_str = "ZOMBIE"; break;
+                default: state_str = "?"; break;
+            }
+            
+            printf("  %x    %s         %d         %s\n", proc_table[i].pid, (long)state_str,
+                   proc_table[i].priority,
+                   (long)(proc_table[i].name ? proc_table[i].name : "-"), 0, 0);
+        }
+    }
+    printf("  Ticks: %x\n", ticks, 0, 0, 0, 0, 0);
+    printf("  Context switches: %d\n", ctx_switches, 0, 0, 0, 0, 0);
+}
+
+// Print one latency histogram (all values in ns)
+void print_lat_hist(const char* name, lat_hist_t* h) {
+    printf("  %s: n=%d avg=%d p50<=%d p99<=%d max=%d\n", (long)name, h->count,
+           h->count ? ticks_to_ns(h->total / h->count) : 0,
+           ticks_to_ns(lat_percentile(h, 500)), ticks_to_ns(lat_percentile(h, 990)),
+           ticks_to_ns(h->max));
+    if (h->count) {
+        printf("    worst at %x (pid %d)\n", h->max_site, h->max_pid, 0, 0, 0, 0);
+    }
+}
+
+// Command: latency
+void cmd_latency(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        lat_reset();
+        puts_ln("Latency histograms reset.");
+        return;
+    }
+    
+    printf("Latency (ns):\n", 0, 0, 0, 0, 0, 0);
+    for (int i = 0; i < MAX_HARTS; i++) {
+        lat_hart_t* lh = &lat_harts[i];
+        if (lh->irqs_off.count == 0 && lh->sched.count == 0) continue;
+        printf(" hart %d\n", i, 0, 0, 0, 0, 0);
+        print_lat_hist("irqs-off", &lh->irqs_off);
+        print_lat_hist("sched   ", &lh->sched);
+    }
+}
+
+// Command: blkbench [depth...]
+// Reads BLKBENCH_IOS 4KB blocks from the start of disk 0, keeping `depth`
+// requests in flight, and reports IOPS and throughput per queue depth.
+#define BLKBENCH_IOS 1024
+#define BLKBENCH_MAX_DEPTH 32
+blk_req_t blkbench_reqs[BLKBENCH_MAX_DEPTH];
+
+void blkbench_run(int depth) {
+    virtio_blk_t* d = &vblk[0];
+    void* bufs[BLKBENCH_MAX_DEPTH];
+    int busy[BLKBENCH_MAX_DEPTH];
+    uint64_t span = d->capacity / 8;  // In 4KB blocks
+    if (span > 2048) span = 2048;     // Stay within the first 8MB
+    if (span == 0) {
+        puts_ln("blkbench: disk too small");
+        return;
+    }
+    
+    for (int k = 0; k < depth; k++) {
+        bufs[k] = page_alloc();
+        busy[k] = 0;
+        if (!bufs[k]) {
+            puts_ln("blkbench: out of pages");
+            for (int j = 0; j < k; j++) page_free(bufs[j]);
+            return;
+        }
+    }
+    
+    long notifies = d->notifies;
+    long interrupts = d->interrupts;
+    int issued = 0;
+    int completed = 0;
+    unsigned long start = read_time();
+    
+    while (completed < BLKBENCH_IOS) {
+        long seen = d->completed;
+        for (int k = 0; k < depth; k++) {
+            blk_req_t* r = &blkbench_reqs[k];
+            if (busy[k] && r->done) {
+                busy[k] = 0;
+                completed++;
+            }
+            if (!busy[k] && issued < BLKBENCH_IOS) {
+                r->op = VIRTIO_BLK_T_IN;
+                r->sector = (uint64_t)(issued % span) * 8;
+                r->nseg = 1;
+                r->seg[0].addr = bufs[k];
+                r->seg[0].len = PAGE_SIZE;
+                r->complete = 0;
+                if (virtio_blk_submit(0, r) != 0) break;
+                busy[k] = 1;
+                issued++;
+            }
+        }
+        virtio_blk_kick(0);
+        if (completed < BLKBENCH_IOS) virtio_blk_idle(0, seen);
+    }
+    
+    unsigned long elapsed = read_time() - start;
+    if (elapsed == 0) elapsed = 1;
+    long iops = (long)((unsigned long)BLKBENCH_IOS * TIMEBASE_HZ / elapsed);
+    printf("bench: blk qd=%d iops=%d kbps=%d notifies=%d irqs=%d\n", depth, iops,
+           iops * (PAGE_SIZE / 1024), d->notifies - notifies, d->interrupts - interrupts, 0);
+    
+    for (int k = 0; k < depth; k++) page_free(bufs[k]);
+}
+
+void cmd_blkbench(int argc, char** argv) {
+    virtio_blk_init();
+    if (vblk_count == 0) {
+        puts_ln("blkbench: no virtio block device");
+        return;
+    }
+    
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            int depth = 0;
+            for (char* p = argv[i]; isdigit(*p); p++) depth = depth * 10 + (*p - '0');
+            if (depth < 1 || depth > BLKBENCH_MAX_DEPTH) {
+                printf("blkbench: depth must be 1-%d\n", BLKBENCH_MAX_DEPTH, 0, 0, 0, 0, 0);
+                return;
+            }
+            blkbench_run(depth);
+        }
+    } else {
+        for (int depth = 1; depth <= BLKBENCH_MAX_DEPTH; depth *= 2) {
+            blkbench_run(depth);
+        }
+    }
+}
+
+// File commands need a mounted filesystem
+int fs_check(const char* cmd) {
+    if (fs_ready()) return 1;
+    puts(cmd);
+    puts_ln(": no filesystem mounted");
+    return 0;
+}
+
+// List the boot archive
+void initrd_ls(void) {
+    if (!initrd) {
+        puts_ln("ls: no initramfs in this kernel");
+        return;
+    }
+    const struct initramfs_entry* e = initramfs_entries();
+    for (uint32_t i = 0; i < initrd->count; i++) {
+        printf("  %d\t%s\n", e[i].size, (long)e[i].name, 0, 0, 0, 0);
+    }
+    printf("%d files (read-only)\n", initrd->count, 0, 0, 0, 0, 0);
+}
+
+// Command: ls [/initrd]
+void cmd_ls(int argc, char** argv) {
+    if (argc > 1 && (strcmp(argv[1], "/initrd") == 0 || is_initrd_path(argv[1]))) {
+        initrd_ls();
+        return;
+    }
+    if (!fs_check("ls")) return;
+    
+    int files = 0;
+    for (uint32_t slot = 0; slot < fs_dir_slots(); slot++) {
+        buf_t* b;
+        struct vibefs_dirent* de = fs_dirent(slot, &b);
+        if (!de) break;
+        if (de->state != VIBEFS_DE_USED) {
+            brelse(b);
+            continue;
+        }
+        char name[VIBEFS_NAME_MAX + 1];
+        strcpy(name, de->name);
+        uint32_t ino = de->ino;
+        brelse(b);
+        
+        buf_t* ib;
+        struct vibefs_inode* ip = fs_iget(ino, &ib);
+        long size = ip ? (long)ip->size : 0;
+        if (ip) brelse(ib);
+        printf("  %d\t%s\n", size, (long)name, 0, 0, 0, 0);
+        files++;
+    }
+    printf("%d files, %d KB free\n", files, fs_free_blocks * (FS_BS / 1024), 0, 0, 0, 0);
+}
+
+// Command: cat <file>
+void cmd_cat(int argc, char** argv) {
+    if (argc < 2) {
+        puts_ln("usage: cat <file>");
+        return;
+    }
+    if (is_initrd_path(argv[1])) {
+        const struct initramfs_entry* e = initrd_lookup(argv[1]);
+        if (!e) {
+            printf("cat: %s: not found\n", (long)argv[1], 0, 0, 0, 0, 0);
+            return;
+        }
+        const char* data = initramfs_map(e);
+        for (uint32_t i = 0; i < e->size; i++) putchar(data[i]);
+        return;
+    }
+    if (!fs_check("cat")) return;
+    uint32_t ino = fs_lookup(argv[1]);
+    if (!ino) {
+        printf("cat: %s: not found\n", (long)argv[1], 0, 0, 0, 0, 0);
+        return;
+    }
+    
+    char buf[512];
+    uint64_t off = 0;
+    long n;
+    while ((n = fs_read(ino, off, buf, sizeof(buf))) > 0) {
+        for (long i = 0; i < n; i++) putchar(buf[i]);
+        off += n;
+    }
+    if (n < 0) puts_ln("cat: read error");
+}
+
+// Command: write <file> <text...>
+void cmd_write(int argc, char** argv) {
+    if (argc < 2) {
+        puts_ln("usage: write <file> <text...>");
+        return;
+    }
+    if (is_initrd_path(argv[1])) {
+        puts_ln("write: /initrd is read-only");
+        return;
+    }
+    if (!fs_check("write")) return;
+    
+    char text[256];
+    long len = 0;
+    for (int i = 2; i < argc; i++) {
+        for (char* p = argv[i]; *p && len < (long)sizeof(text) - 2; p++) text[len++] = *p;
+        if (i < argc - 1 && len < (long)sizeof(text) - 2) text[len++] = ' ';
+    }
+    text[len++] = '\n';
+    
+    uint32_t ino = fs_create(argv[1]);
+    if (!ino || fs_write(ino, 0, text, len) != len) {
+        printf("write: %s: failed\n", (long)argv[1], 0, 0, 0, 0, 0);
+    }
+}
+
+// Command: stat <file>
+void cmd_stat(int argc, char** argv) {
+    if (argc < 2) {
+        puts_ln("usage: stat <file>");
+        return;
+    }
+    if (is_initrd_path(argv[1])) {
+        const struct initramfs_entry* e = initrd_lookup(argv[1]);
+        if (!e) {
+            printf("stat: %s: not found\n", (long)argv[1], 0, 0, 0, 0, 0);
+            return;
+        }
+        printf("  File:    %s (initramfs, read-only)\n", (long)argv[1], 0, 0, 0, 0, 0);
+        printf("  Size:    %d bytes, mode %x\n", e->size, e->mode, 0, 0, 0, 0);
+        printf("  Mapped:  %x\n", (long)initramfs_map(e), 0, 0, 0, 0, 0);
+        return;
+    }
+    if (!fs_check("stat")) return;
+    uint32_t ino = fs_lookup(argv[1]);
+    buf_t* ib;
+    struct vibefs_inode* ip = ino ? fs_iget(ino, &ib) : 0;
+    if (!ip) {
+        printf("stat: %s: not found\n", (long)argv[1], 0, 0, 0, 0, 0);
+        return;
+    }
+    
+    printf("  File:    %s\n", (long)argv[1], 0, 0, 0, 0, 0);
+    printf("  Inode:   %d (%s, %d links)\n", ino,
+           (long)(ip->type == VIBEFS_T_DIR ? "directory" : "file"), ip->nlink, 0, 0, 0);
+    printf("  Size:    %d bytes in %d blocks\n", (long)ip->size, fs_nblocks(ip), 0, 0, 0, 0);
+    printf("  Modified: %d (seconds since epoch)\n", (long)ip->mtime, 0, 0, 0, 0, 0);
+    printf("  Extents: %d\n", ip->nextents, 0, 0, 0, 0, 0);
+    for (uint32_t i = 0; i < ip->nextents; i++) {
+        printf("    [%d] blocks %d-%d\n", i, ip->ext[i].start,
+               ip->ext[i].start + ip->ext[i].len - 1, 0, 0, 0);
+    }
+    brelse(ib);
+}
+
+// Command: cp <src> <dst>
+void cmd_cp(int argc, char** argv) {
+    if (argc < 3) {
+        puts_ln("usage: cp <src> <dst>");
+        return;
+    }
+    if (!fs_check("cp")) return;
+    if (is_initrd_path(argv[2])) {
+        puts_ln("cp: /initrd is read-only");
+        return;
+    }
+    if (is_initrd_path(argv[1])) {
+        // Straight from the archive pages into the buffer cache
+        const struct initramfs_entry* e = initrd_lookup(argv[1]);
+        uint32_t dst = e ? fs_create(argv[2]) : 0;
+        if (!e || !dst || fs_write(dst, 0, initramfs_map(e), e->size) != (long)e->size) {
+            printf("cp: %s: failed\n", (long)argv[1], 0, 0, 0, 0, 0);
+        }
+        return;
+    }
+    uint32_t src = fs_lookup(argv[1]);
+    if (!src) {
+        printf("cp: %s: not found\n", (long)argv[1], 0, 0, 0, 0, 0);
+        return;
+    }
+    if (src == fs_lookup(argv[2])) return;
+    uint32_t dst = fs_create(argv[2]);
+    char* buf = (char*)page_alloc();
+    if (!dst || !buf) {
+        printf("cp: %s: cannot create\n", (long)argv[2], 0, 0, 0, 0, 0);
+        page_free(buf);
+        return;
+    }
+    
+    uint64_t off = 0;
+    long n;
+    while ((n = fs_read(src, off, buf, PAGE_SIZE)) > 0) {
+        if (fs_write(dst, off, buf, n) != n) {
+            puts_ln("cp: write error");
+            break;
+        }
+        off += n;
+    }
+    if (n < 0) puts_ln("cp: read error");
+    page_free(buf);
+}
+
+// Command: rm <file>
+void cmd_rm(int argc, char** argv) {
+    if (!fs_check("rm")) return;
+    if (fs_read_only) {
+        puts_ln("rm: filesystem is read-only");
+        return;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (is_initrd_path(argv[i])) {
+            puts_ln("rm: /initrd is read-only");
+        } else if (fs_unlink(argv[i]) != 0) {
+            printf("rm: %s: not found\n", (long)argv[i], 0, 0, 0, 0, 0);
+        }
+    }
+}
+
+void execute_command(char* line);
+
+#define SCRIPT_MAX_DEPTH 8       // Nesting limit for scripts running sh
+
+int script_depth = 0;
+
+// Run a script: each line is a shell command, '#' starts a comment
+void run_script(const char* text, long len) {
+    char line[256];
+    long pos = 0;
+    script_depth++;
+    while (pos < len) {
+        long n = 0;
+        while (pos < len && text[pos] != '\n') {
+            if (n < (long)sizeof(line) - 1) line[n++] = text[pos];
+            pos++;
+        }
+        pos++;  // Skip the newline
+        line[n] = '\0';
+        if (n > 0 && line[0] != '#') execute_command(line);
+    }
+    script_depth--;
+}
+
+// Run a script file: from the archive in place, or read from the disk a
+// page at a time, each page cut after its last complete line. Returns -1
+// if the file doesn't exist, -2 on a read error or a line over a page.
+int run_script_file(const char* path) {
+    if (is_initrd_path(path)) {
+        const struct initramfs_entry* e = initrd_lookup(path);
+        if (!e) return -1;
+        run_script(initramfs_map(e), e->size);
+        return 0;
+    }
+    
+    uint32_t ino = fs_ready() ? fs_lookup(path) : 0;
+    if (!ino) return -1;
+    char* buf = (char*)page_alloc();
+    if (!buf) return -2;
+    uint64_t off = 0;
+    long n;
+    while ((n = fs_read(ino, off, buf, PAGE_SIZE)) > 0) {
+        if (n == PAGE_SIZE) {
+            while (n > 0 && buf[n - 1] != '\n') n--;
+            if (n == 0) { n = -1; break; }
+        }
+        run_script(buf, n);
+        off += n;
+    }
+    page_free(buf);
+    return n == 0 ? 0 : -2;
+}
+
+// Command: sh <script>
+void cmd_sh(int argc, char** argv) {
+    if (argc < 2) {
+        puts_ln("usage: sh <script>");
+        return;
+    }
+    if (script_depth >= SCRIPT_MAX_DEPTH) {
+        puts_ln("sh: scripts nested too deeply");
+        return;
+    }
+    int r = run_script_file(argv[1]);
+    if (r == -1) {
+        printf("sh: %s: not found\n", (long)argv[1], 0, 0, 0, 0, 0);
+    } else if (r != 0) {
+        printf("sh: %s: read error\n", (long)argv[1], 0, 0, 0, 0, 0);
+    }
+}
+
+// Command: fsbench
+// Sequential write/read of a FSBENCH_KB file (cold cache for the read), then
+// create/lookup/unlink of FSBENCH_FILES small files. Writes include a sync.
+#define FSBENCH_KB 4096
+#define FSBENCH_FILES 256
+
+// Per-second rate of `count` things done in `elapsed` timer ticks
+long bench_rate(long count, unsigned long elapsed) {
+    if (elapsed == 0) elapsed = 1;
+    return (long)((unsigned long)count * TIMEBASE_HZ / elapsed);
+}
+
+void cmd_fsbench(void) {
+    if (!fs_check("fsbench")) return;
+    char* buf = (char*)page_alloc();
+    if (!buf) {
+        puts_ln("fsbench: out of pages");
+        return;
+    }
+    for (int i = 0; i < PAGE_SIZE; i++) buf[i] = (char)i;
+    
+    uint32_t ino = fs_create("fsbench.dat");
+    if (!ino) {
+        puts_ln("fsbench: cannot create fsbench.dat");
+        page_free(buf);
+        return;
+    }
+    
+    unsigned long start = read_time();
+    for (long off = 0; off < FSBENCH_KB * 1024L; off += PAGE_SIZE) {
+        if (fs_write(ino, off, buf, PAGE_SIZE) != PAGE_SIZE) {
+            puts_ln("fsbench: write failed (disk full?)");
+            break;
+        }
+    }
+    bcache_sync();
+    printf("bench: fs seq_write kb=%d kbps=%d\n", FSBENCH_KB,
+           bench_rate(FSBENCH_KB, read_time() - start), 0, 0, 0, 0);
+    
+    bcache_invalidate(fs_dev);
+    start = read_time();
+    for (long off = 0; off < FSBENCH_KB * 1024L; off += PAGE_SIZE) {
+        if (fs_read(ino, off, buf, PAGE_SIZE) != PAGE_SIZE) break;
+    }
+    printf("bench: fs seq_read kb=%d kbps=%d\n", FSBENCH_KB,
+           bench_rate(FSBENCH_KB, read_time() - start), 0, 0, 0, 0);
+    fs_unlink("fsbench.dat");
+    
+    char name[16];
+    start = read_time();
+    for (int i = 0; i < FSBENCH_FILES; i++) {
+        simple_sprintf(name, sizeof(name), "fsb%d", i, 0, 0, 0, 0, 0);
+        uint32_t f = fs_create(name);
+        if (!f || fs_write(f, 0, buf, 100) != 100) {
+            puts_ln("fsbench: create failed");
+            break;
+        }
+    }
+    bcache_sync();
+    printf("bench: fs create files=%d ops=%d\n", FSBENCH_FILES,
+           bench_rate(FSBENCH_FILES, read_time() - start), 0, 0, 0, 0);
+    
+    start = read_time();
+    for (int i = 0; i < FSBENCH_FILES; i++) {
+        simple_sprintf(name, sizeof(name), "fsb%d", i, 0, 0, 0, 0, 0);
+        fs_lookup(name);
+    }
+    printf("bench: fs lookup files=%d ops=%d\n", FSBENCH_FILES,
+           bench_rate(FSBENCH_FILES, read_time() - start), 0, 0, 0, 0);
+    
+    start = read_time();
+    for (int i = 0; i < FSBENCH_FILES; i++) {
+        simple_sprintf(name, sizeof(name), "fsb%d", i, 0, 0, 0, 0, 0);
+        fs_unlink(name);
+    }
+    bcache_sync();
+    printf("bench: fs unlink files=%d ops=%d\n", FSBENCH_FILES,
+           bench_rate(FSBENCH_FILES, read_time() - start), 0, 0, 0, 0);
+    
+    page_free(buf);
+}
+
+// Command: ipcbench
+// Message throughput (the sender keeps the ring full) and one-way latency
+// (one message at a time, stamped by the sender and checked on arrival) for
+// zero-copy channels vs the copy-based sys_msg_send/sys_msg_recv pair. The
+// shell sends; a separate receiver thread reads all of each payload, so
+// every message crosses threads. On a zero-copy channel the receiver sleeps
+// on an empty ring; the copy-based calls don't block, so that side yields.
+#define IPCBENCH_MSGS 4096
+#define IPCBENCH_POOL (CHAN_SLOTS + 1)  // Ring slots plus the page being read
+
+// Receiving end of one run
+typedef struct {
+    int ch;                     // -1 if the channel couldn't be created
+    int copy;                   // Copy-based path instead of zero-copy
+    int live;
+    char* rbuf;                 // Copy-based path: receive buffer
+    uint32_t sum;               // Checksum of everything read
+    unsigned long lat_total;    // Sum of send -> receive times (ticks)
+} ipcbench_rx_t;
+
+long ipcbench_sleeps;           // Kernel entries over all runs
+long ipcbench_wakeups;
+
+// Stand-in for the receiver using the payload
+uint32_t ipc_consume(const uint8_t* p, uint32_t len) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) sum += p[i];
+    return sum;
+}
+
+// Receiver thread; each payload starts with the sender's timestamp
+void ipcbench_rx(void* arg) {
+    ipcbench_rx_t* rx = (ipcbench_rx_t*)arg;
+    for (int i = 0; i < IPCBENCH_MSGS && rx->ch >= 0; i++) {
+        const uint8_t* p;
+        long len;
+        if (rx->copy) {
+            while ((len = sys_msg_recv(rx->ch, rx->rbuf, PAGE_SIZE)) < 0) kthread_yield();
+            p = (const uint8_t*)rx->rbuf;
+        } else {
+            chan_msg_t m;
+            chan_recv(rx->ch, &m);
+            p = (const uint8_t*)(unsigned long)m.page;
+            len = m.len;
+        }
+        unsigned long sent;
+        memcpy(&sent, p, sizeof(sent));
+        rx->lat_total += read_time() - sent;
+        rx->sum += ipc_consume(p, len);
+    }
+    long s = intr_off();
+    rx->live = 0;
+    proc_wakeup(rx);
+    intr_restore(s);
+}
+
+// Send IPCBENCH_MSGS messages of `size` bytes to a new receiver thread.
+// With `paced`, yield after each send so the receiver takes it and goes back
+// to waiting before the next one. Returns elapsed ticks, 0 on setup failure.
+unsigned long ipcbench_run(ipcbench_rx_t* rx, char** pool, char* ubuf, uint32_t size,
+                           int copy, int paced) {
+    rx->ch = -1;
+    rx->copy = copy;
+    rx->live = 1;
+    rx->lat_total = 0;
+    proc_t* p = kthread_create("ipcbench", ipcbench_rx, rx);
+    if (!p) return 0;
+    int ch = chan_create(current_proc, p);  // Before the receiver first runs
+    rx->ch = ch;
+    
+    unsigned long start = read_time();
+    for (int i = 0; i < IPCBENCH_MSGS && ch >= 0; i++) {
+        char* buf = copy ? ubuf : pool[i % IPCBENCH_POOL];
+        memset(buf, i, size);
+        unsigned long now = read_time();
+        memcpy(buf, &now, sizeof(now));
+        if (copy) {
+            while (sys_msg_send(ch, buf, size) != 0) kthread_yield();
+        } else {
+            chan_send(ch, buf, size, i);
+        }
+        if (paced) kthread_yield();
+    }
+    long s = intr_off();
+    while (rx->live) proc_sleep(rx);
+    intr_restore(s);
+    unsigned long elapsed = read_time() - start;
+    
+    if (ch < 0) return 0;
+    ipcbench_sleeps += chans[ch].sleeps;
+    ipcbench_wakeups += chans[ch].wakeups;
+    chan_destroy(ch);
+    return elapsed;
+}
+
+void cmd_ipcbench(void) {
+    static const int sizes[] = {64, 512, 2048, 4096};
+    char* pool[IPCBENCH_POOL];
+    ipcbench_rx_t rx;
+    char* ubuf = (char*)page_alloc();
+    rx.rbuf = (char*)page_alloc();
+    int npool = 0;
+    while (npool < IPCBENCH_POOL && (pool[npool] = (char*)page_alloc())) npool++;
+    if (!ubuf || !rx.rbuf || npool < IPCBENCH_POOL) {
+        puts_ln("ipcbench: out of pages");
+        goto out;
+    }
+    
+    rx.sum = 0;
+    ipcbench_sleeps = 0;
+    ipcbench_wakeups = 0;
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        uint32_t size = sizes[s];
+        long rate[2], lat_ns[2];
+        int ok = 1;
+        for (int copy = 0; copy < 2; copy++) {
+            unsigned long t = ipcbench_run(&rx, pool, ubuf, size, copy, 0);
+            ok &= t != 0;
+            rate[copy] = bench_rate(IPCBENCH_MSGS, t);
+            ok &= ipcbench_run(&rx, pool, ubuf, size, copy, 1) != 0;
+            lat_ns[copy] = ticks_to_ns(rx.lat_total) / IPCBENCH_MSGS;
+        }
+        if (!ok) {
+            puts_ln("ipcbench: cannot start the receiver");
+            goto out;
+        }
+        printf("bench: ipc size=%d zc_msgs=%d copy_msgs=%d zc_ns=%d copy_ns=%d\n",
+               size, rate[0], rate[1], lat_ns[0], lat_ns[1], 0);
+    }
+    printf("ipcbench: kernel entries: %d sleeps, %d wakeups (checksum %x)\n",
+           ipcbench_sleeps, ipcbench_wakeups, rx.sum, 0, 0, 0);
+    
+out:
+    for (int i = 0; i < npool; i++) page_free(pool[i]);
+    page_free(ubuf);
+    page_free(rx.rbuf);
+}
+
+// Command: ctxbench
+// Two threads pass the CPU back and forth CTXBENCH_SWITCHES times, first
+// with kthread_yield (callee-saved switch), then by each raising a software
+// interrupt (full trap frame save/restore plus the switch).
+#define CTXBENCH_SWITCHES 20000
+
+int ctxbench_live;              // Benchmark threads still running
+
+void ctxbench_exit(void) {
+    long s = intr_off();
+    if (--ctxbench_live == 0) proc_wakeup(&ctxbench_live);
+    intr_restore(s);
+}
+
+void ctxbench_yield(void* arg) {
+    (void)arg;
+    for (int i = 0; i < CTXBENCH_SWITCHES / 2; i++) kthread_yield();
+    ctxbench_exit();
+}
+
+void ctxbench_trap(void* arg) {
+    (void)arg;
+    for (int i = 0; i < CTXBENCH_SWITCHES / 2; i++) proc_kick();
+    ctxbench_exit();
+}
+
+// Run two copies of fn; returns ns per switch (0 if the threads can't start)
+long ctxbench_run(void (*fn)(void*), long* switches) {
+    long start_switches = ctx_switches;
+    unsigned long start = read_time();
+    
+    long s = intr_off();
+    ctxbench_live = 0;
+    for (int i = 0; i < 2; i++) {
+        if (kthread_create("ctxbench", fn, 0)) ctxbench_live++;
+    }
+    if (ctxbench_live < 2) {
+        puts_ln("ctxbench: cannot create threads");
+    }
+    while (ctxbench_live) proc_sleep(&ctxbench_live);
+    intr_restore(s);
+    
+    *switches = ctx_switches - start_switches;
+    if (*switches == 0) return 0;
+    return ticks_to_ns(read_time() - start) / *switches;
+}
+
+void cmd_ctxbench(void) {
+    long yield_switches, trap_switches;
+    long yield_ns = ctxbench_run(ctxbench_yield, &yield_switches);
+    long trap_ns = ctxbench_run(ctxbench_trap, &trap_switches);
+    printf("bench: ctx yield_ns=%d trap_ns=%d switches=%d/%d\n", yield_ns, trap_ns,
+           yield_switches, trap_switches, 0, 0);
+}
+
+// Command: mtxbench
+// Uncontended: lock/unlock pairs from the shell alone. Contended:
+// MTXBENCH_THREADS threads increment a shared counter under one mutex and
+// yield while holding it, so every other thread finds it taken. The shell
+// waits for them on a condition variable. The threads use the kernel build
+// of ulock.c, whose slow path calls futex_wait/futex_wake directly, so the
+// numbers include no ecall or trap cost.
+#define MTXBENCH_OPS 20000
+#define MTXBENCH_THREADS 4
+
+umutex_t mtxbench_lock = UMUTEX_INIT;
+ucond_t mtxbench_done = UCOND_INIT;
+int mtxbench_live;
+long mtxbench_counter;
+
+void mtxbench_thread(void* arg) {
+    (void)arg;
+    for (int i = 0; i < MTXBENCH_OPS / MTXBENCH_THREADS; i++) {
+        umutex_lock(&mtxbench_lock);
+        mtxbench_counter++;
+        kthread_yield();
+        umutex_unlock(&mtxbench_lock);
+    }
+    umutex_lock(&mtxbench_lock);
+    if (--mtxbench_live == 0) ucond_signal(&mtxbench_done);
+    umutex_unlock(&mtxbench_lock);
+}
+
+void cmd_mtxbench(void) {
+    umutex_t m = UMUTEX_INIT;
+    long waits = futex_waits, wakes = futex_wakes;
+    unsigned long start = read_time();
+    for (int i = 0; i < MTXBENCH_OPS; i++) {
+        umutex_lock(&m);
+        umutex_unlock(&m);
+    }
+    unsigned long elapsed = read_time() - start;
+    printf("bench: mutex uncontended ops_per_sec=%d ns_per_op=%d waits=%d wakes=%d\n",
+           bench_rate(MTXBENCH_OPS, elapsed), ticks_to_ns(elapsed) / MTXBENCH_OPS,
+           futex_waits - waits, futex_wakes - wakes, 0, 0);
+    
+    waits = futex_waits;
+    wakes = futex_wakes;
+    long switches = ctx_switches;
+    mtxbench_counter = 0;
+    start = read_time();
+    umutex_lock(&mtxbench_lock);
+    mtxbench_live = 0;
+    for (int i = 0; i < MTXBENCH_THREADS; i++) {
+        if (kthread_create("mtxbench", mtxbench_thread, 0)) mtxbench_live++;
+    }
+    int threads = mtxbench_live;
+    while (mtxbench_live) ucond_wait(&mtxbench_done, &mtxbench_lock);
+    umutex_unlock(&mtxbench_lock);
+    elapsed = read_time() - start;
+    
+    long expect = threads * (MTXBENCH_OPS / MTXBENCH_THREADS);
+    printf("bench: mutex contended threads=%d ops_per_sec=%d waits=%d wakes=%d switches=%d\n", threads,
+           bench_rate(expect, elapsed), futex_waits - waits, futex_wakes - wakes,
+           ctx_switches - switches, 0);
+    if (mtxbench_counter != expect) {
+        printf("mtxbench: counter is %d, expected %d\n", mtxbench_counter, expect,
+               0, 0, 0, 0);
+    }
+}
+
+// Boot-phase profiler: rdtime stamps at the end of each boot phase. start.S
+// records _start and the end of the BSS clear; the time CSR counts from
+// machine reset, so the time before _start is the firmware's.
+#define BOOT_PHASES_MAX 16
+
+typedef struct {
+    const char* name;
+    unsigned long time;
+} boot_phase_t;
+
+unsigned long boot_time_start;  // _start (start.S)
+unsigned long boot_time_bss;    // BSS cleared (start.S)
+boot_phase_t boot_phases[BOOT_PHASES_MAX];
+int boot_nphases;
+
+void boot_mark(const char* name) {
+    if (boot_nphases == BOOT_PHASES_MAX) return;
+    boot_phases[boot_nphases].name = name;
+    boot_phases[boot_nphases].time = read_time();
+    boot_nphases++;
+}
+
+// Time from _start to the last phase (the shell prompt)
+unsigned long boot_kernel_ticks(void) {
+    if (boot_nphases == 0) return 0;
+    return boot_phases[boot_nphases - 1].time - boot_time_start;
+}
+
+// Command: boottime
+void cmd_boottime(void) {
+    puts_ln("Boot phases (us since reset, +us in phase):");
+    printf("  firmware    %d\n", ticks_to_ns(boot_time_start) / 1000, 0, 0, 0, 0, 0);
+    printf("  bss         %d +%d\n", ticks_to_ns(boot_time_bss) / 1000,
+           ticks_to_ns(boot_time_bss - boot_time_start) / 1000, 0, 0, 0, 0);
+    unsigned long prev = boot_time_bss;
+    for (int i = 0; i < boot_nphases; i++) {
+        char name[16];
+        int n = 0;
+        while (boot_phases[i].name[n] && n < 11) {
+            name[n] = boot_phases[i].name[n];
+            n++;
+        }
+        while (n < 11) name[n++] = ' ';
+        name[n] = 0;
+        printf("  %s %d +%d\n", (long)name, ticks_to_ns(boot_phases[i].time) / 1000,
+               ticks_to_ns(boot_phases[i].time - prev) / 1000, 0, 0, 0);
+        prev = boot_phases[i].time;
+    }
+    printf("  kernel total: %d us\n", ticks_to_ns(boot_kernel_ticks()) / 1000, 0, 0, 0, 0, 0);
+}
+
+// Execute a command
+void execute_command(char* line) {
+    char* argv[16];
+    int argc = parse_args(line, argv, 16);
+    
+    if (argc == 0) return;
+    
+    if (strcmp(argv[0], "help") == 0) {
+        cmd_help();
+    } else if (strcmp(argv[0], "echo") == 0) {
+        cmd_echo(argc, argv);
+    } else if (strcmp(argv[0], "clear") == 0) {
+        cmd_clear();
+    } else if (strcmp(argv[0], "meminfo") == 0) {
+        cmd_meminfo();
+    } else if (strcmp(argv[0], "procs") == 0) {
+        cmd_procs();
+    } else if (strcmp(argv[0], "boottime") == 0) {
+        cmd_boottime();
+    } else if (strcmp(argv[0], "latency") == 0) {
+        cmd_latency(argc, argv);
+    } else if (strcmp(argv[0], "blkbench") == 0) {
+        cmd_blkbench(argc, argv);
+    } else if (strcmp(argv[0], "sync") == 0) {
+        if (bcache_sync() != 0) puts_ln("sync: write error");
+    } else if (strcmp(argv[0], "ls") == 0) {
+        cmd_ls(argc, argv);
+    } else if (strcmp(argv[0], "cat") == 0) {
+        cmd_cat(argc, argv);
+    } else if (strcmp(argv[0], "write") == 0) {
+        cmd_write(argc, argv);
+    } else if (strcmp(argv[0], "stat") == 0) {
+        cmd_stat(argc, argv);
+    } else if (strcmp(argv[0], "cp") == 0) {
+        cmd_cp(argc, argv);
+    } else if (strcmp(argv[0], "rm") == 0) {
+        cmd_rm(argc, argv);
+    } else if (strcmp(argv[0], "fsbench") == 0) {
+        cmd_fsbench();
+    } else if (strcmp(argv[0], "ipcbench") == 0) {
+        cmd_ipcbench();
+    } else if (strcmp(argv[0], "ctxbench") == 0) {
+        cmd_ctxbench();
+    } else if (strcmp(argv[0], "mtxbench") == 0) {
+        cmd_mtxbench();
+    } else if (strcmp(argv[0], "sh") == 0) {
+        cmd_sh(argc, argv);
+    } else {
+        puts("Unknown command: ");
+        puts(argv[0]);
+        putchar('\n');
+        puts_ln("Type 'help' for available commands.");
+    }
+}
+
+// Boot banner, clear-screen escape included, so it goes out in one console write
+const char boot_banner[] =
+    "\033[2J\033[H"
+    "====================================\n"
+    "  VibeOS - RISC-V Edition\n"
+    "  \"It Just Works(tm)\"\n"
+    "====================================\n"
+    "\n";
+
+// Main kernel entry point
+void kernel_main(void) {
+    // Initialize memory management
+    mem_init();
+    boot_mark("mem_init");
+    
+    // Initialize process management; the shell runs as the first thread
+    proc_init();
+    kthread_init("shell");
     
-    // Enable interrupts
+    // Start latency tracing from a clean slate
+    lat_reset();
+    boot_mark("proc_init");
+    
+    // Enable interrupts and start the scheduler tick
     enable_interrupts();
+    enable_timer();
+    boot_mark("interrupts");
     
     char line[256];
     
     // Clear screen and print banner
-    cmd_clear();
-    puts_ln("====================================");
-    puts_ln("  VibeOS - RISC-V Edition");
-    puts_ln("  \"It Just Works(tm)\"");
-    puts_ln("====================================");
-    puts_ln("");
+    puts(boot_banner);
+    boot_mark("banner");
+    
+    // The block device is probed on first use; the cache and its
+    // write-back thread cost nothing until then
+    bcache_init();
+    kthread_create("kflushd", kflushd, 0);
+    
+    // Boot script: from the initramfs if the kernel has one, else from the disk
+    if (initramfs_init() == 0) {
+        printf("initramfs: %d files, %d bytes at %x\n", initrd->count, initrd->size,
+               (long)initrd, 0, 0, 0);
+        run_script_file(INITRD_PREFIX "init.rc");
+    } else {
+        run_script_file("init.rc");
+    }
+    boot_mark("init.rc");
+    
     puts_ln("Type 'help' for available commands.");
     puts_ln("");
     
+    boot_mark("prompt");
+    printf("bench: boot kernel_us=%d firmware_us=%d\n", ticks_to_ns(boot_kernel_ticks()) / 1000,
+           ticks_to_ns(boot_time_start) / 1000, 0, 0, 0, 0);
+    
     // Main shell loop
     while (1) {
         printf("vibe> ", 0, 0, 0, 0, 0, 0);
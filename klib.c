@@ -0,0 +1,445 @@
+// klib.c - Portable kernel library: strings, formatting, input buffer,
+// heap and argument parsing
+//
+// Nothing here touches hardware, so the same file also builds for the host
+// (tests/), where the unit tests and microbenchmarks run it natively.
+#include "klib.h"
+
+// Simple string functions
+long strlen(const char* str) {
+    long len = 0;
+    while (str[len]) len++;
+    return len;
+}
+
+int strcmp(const char* s1, const char* s2) {
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char*)s1 - *(unsigned char*)s2;
+}
+
+int strncmp(const char* s1, const char* s2, long n) {
+    while (n && *s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+        n--;
+    }
+    if (n == 0) return 0;
+    return *(unsigned char*)s1 - *(unsigned char*)s2;
+}
+
+void strcpy(char* dst, const char* src) {
+    while (*src) {
+        *dst++ = *src++;
+    }
+    *dst = '\0';
+}
+
+void strncpy(char* dst, const char* src, long n) {
+    while (n && *src) {
+        *dst++ = *src++;
+        n--;
+    }
+    if (n > 0) *dst = '\0';
+}
+
+// Character classification functions (handle unsigned char properly)
+int isdigit(int c) {
+    return c >= '0' && c <= '9';
+}
+
+int isalpha(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+int isalnum(int c) {
+    return isalpha(c) || isdigit(c);
+}
+
+int isspace(int c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+int isupper(int c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+int islower(int c) {
+    return c >= 'a' && c <= 'z';
+}
+
+// Character conversion functions
+int toupper(int c) {
+    if (c >= 'a' && c <= 'z') {
+        return c - 32;
+    }
+    return c;
+}
+
+int tolower(int c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c + 32;
+    }
+    return c;
+}
+
+// Memset - fill memory with value
+void memset(void* ptr, int value, long size) {
+    unsigned char* p = (unsigned char*)ptr;
+    for (long i = 0; i < size; i++) {
+        p[i] = (unsigned char)value;
+    }
+}
+
+// Memcpy - copy non-overlapping memory
+void* memcpy(void* dst, const void* src, long size) {
+    unsigned char* d = (unsigned char*)dst;
+    const unsigned char* s = (const unsigned char*)src;
+    for (long i = 0; i < size; i++) {
+        d[i] = s[i];
+    }
+    return dst;
+}
+
+// Internal function for number to string conversion
+void int_to_str(long num, char* str, int base) {
+    char digits[] = "0123456789abcdef";
+    char buffer[32];
+    int i = 0;
+    
+    if (num == 0) {
+        str[0] = '0';
+        str[1] = '\0';
+        return;
+    }
+    
+    // Only emit a leading '-' for base-10.
+    // For hex (%x) and other bases, mimic typical printf behavior by treating the
+    // value as unsigned (two's complement representation for negatives).
+    int sign = (base == 10 && num < 0) ? 1 : 0;
+    unsigned long unum = sign ? (unsigned long)(-(unsigned long)num) : (unsigned long)num;
+    
+    while (unum > 0) {
+        buffer[i++] = digits[unum % (unsigned long)base];
+        unum /= (unsigned long)base;
+    }
+    
+    if (sign) str[0] = '-';
+    int j = 0;
+    while (i > 0) {
+        str[j + sign] = buffer[--i];
+        j++;
+    }
+    str[j + sign] = '\0';
+}
+
+// vsprintf implementation - uses variadic args directly
+void simple_sprintf(char* buf, int buf_size, const char* fmt, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6) {
+    int buf_idx = 0;
+    int arg_idx = 0;
+    long args[6] = {arg1, arg2, arg3, arg4, arg5, arg6};
+    
+    while (*fmt && buf_idx < buf_size - 1) {
+        if (*fmt == '%' && *(fmt + 1)) {
+            fmt++;
+            switch (*fmt) {
+                case 'd': {
+                    if (arg_idx >= 6) break;
+                    long num = args[arg_idx++];
+                    char num_str[32];
+                    int_to_str(num, num_str, 10);
+                    int i = 0;
+                    while (num_str[i] && buf_idx < buf_size - 1) {
+                        buf[buf_idx++] = num_str[i++];
+                    }
+                    break;
+                }
+                case 'x': {
+                    if (arg_idx >= 6) break;
+                    long num = args[arg_idx++];
+                    char hex_str[32];  // 16 digits for negative values, plus NUL
+                    int_to_str(num, hex_str, 16);
+                    int i = 0;
+                    while (hex_str[i] && buf_idx < buf_size - 1) {
+                        buf[buf_idx++] = hex_str[i++];
+                    }
+                    break;
+                }
+                case 's': {
+                    if (arg_idx >= 6) break;
+                    char* str = (char*)args[arg_idx++];
+                    if (str) {
+                        while (*str && buf_idx < buf_size - 1) {
+                            buf[buf_idx++] = *str++;
+                        }
+                    }
+                    break;
+                }
+                case 'c': {
+                    if (arg_idx >= 6) break;
+                    if (buf_idx < buf_size - 1) {
+                        buf[buf_idx++] = (char)args[arg_idx++];
+                    }
+                    break;
+                }
+                case '%': {
+                    if (buf_idx < buf_size - 1) {
+                        buf[buf_idx++] = '%';
+                    }
+                    break;
+                }
+                default:
+                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '%';
+                    if (buf_idx < buf_size - 1) buf[buf_idx++] = *fmt;
+                    break;
+            }
+        } else if (*fmt == '\\' && *(fmt + 1)) {
+            fmt++;
+            switch (*fmt) {
+                case 'n':
+                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\n';
+                    break;
+                case 'r':
+                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\r';
+                    break;
+                case 't':
+                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\t';
+                    break;
+                case '\\':
+                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\\';
+                    break;
+                default:
+                    if (buf_idx < buf_size - 1) buf[buf_idx++] = '\\';
+                    if (buf_idx < buf_size - 1) buf[buf_idx++] = *fmt;
+                    break;
+            }
+        } else {
+            if (buf_idx < buf_size - 1) buf[buf_idx++] = *fmt;
+        }
+        fmt++;
+    }
+    buf[buf_idx] = '\0';
+}
+
+// Phase 2: Keyboard & Input Handling
+
+// Input buffer for circular queue
+char input_buffer[INPUT_BUFFER_SIZE];
+int input_head = 0;
+int input_tail = 0;
+int input_count = 0;
+
+// PS/2 key code to ASCII translation table (US layout)
+char keycode_to_ascii[128] = {
+    0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', 8, 9,
+    'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', 13, 0, 'a', 's',
+    'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0, '\\', 'z', 'x', 'c', 'v',
+    'b', 'n', 'm', ',', '.', '/', 0, '*', 0, ' ', 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '-', 0, 0, 0, '+', 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// Shifted key codes
+char keycode_to_ascii_shift[128] = {
+    0, 27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', 8, 9,
+    'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', 13, 0, 'A', 'S',
+    'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~', 0, '|', 'Z', 'X', 'C', 'V',
+    'B', 'N', 'M', '<', '>', '?', 0, '*', 0, ' ', 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '-', 0, 0, 0, '+', 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+int shift_pressed = 0;
+int ctrl_pressed = 0;
+int alt_pressed = 0;
+
+// Input buffer management
+void input_buffer_put(char c) {
+    if (input_count < INPUT_BUFFER_SIZE) {
+        input_buffer[input_tail] = c;
+        input_tail = (input_tail + 1) % INPUT_BUFFER_SIZE;
+        input_count++;
+    }
+}
+
+int input_buffer_get(void) {
+    if (input_count > 0) {
+        unsigned char c = (unsigned char)input_buffer[input_head];
+        input_head = (input_head + 1) % INPUT_BUFFER_SIZE;
+        input_count--;
+        return (int)c;
+    }
+    return -1;  // EOF
+}
+
+int input_buffer_empty(void) {
+    return input_count == 0;
+}
+
+// PS/2 keyboard handler
+void keyboard_handler(int keycode) {
+    int key_released = keycode & 0x80;
+    keycode = keycode & 0x7F;
+    
+    if (key_released) {
+        // Handle key release
+        if (keycode == 0x2A || keycode == 0x36) {  // Left/Right Shift
+            shift_pressed = 0;
+        } else if (keycode == 0x1D) {  // Left Ctrl
+            ctrl_pressed = 0;
+        } else if (keycode == 0x38) {  // Left Alt
+            alt_pressed = 0;
+        }
+    } else {
+        // Handle key press
+        switch (keycode) {
+            case 0x2A:
+            case 0x36:  // Left/Right Shift
+                shift_pressed = 1;
+                break;
+            case 0x1D:  // Left Ctrl
+                ctrl_pressed = 1;
+                break;
+            case 0x38:  // Left Alt
+                alt_pressed = 1;
+                break;
+            case 0x53:  // Delete (Ctrl+D)
+                if (ctrl_pressed) {
+                    input_buffer_put(4);  // Ctrl+D = ASCII 4
+                }
+                break;
+            default:
+                if (keycode < 128) {
+                    char c = shift_pressed ? keycode_to_ascii_shift[keycode] : keycode_to_ascii[keycode];
+                    if (c != 0) {
+                        if (ctrl_pressed && (c >= 'a' && c <= 'z')) {
+                            input_buffer_put((char)(c - 'a' + 1));  // Ctrl+A=1, Ctrl+C=3, etc.
+                        } else {
+                            input_buffer_put(c);
+                        }
+                    }
+                }
+                break;
+        }
+    }
+}
+
+// Phase 3: Memory Management
+
+// Simple bump allocator over a region handed to heap_init()
+static char* heap_ptr = 0;
+static char* heap_end = 0;
+
+// Memory statistics - using global variables for proper initialization
+long mem_total_allocated = 0;
+long mem_total_freed = 0;
+long mem_current_usage = 0;
+long mem_peak_usage = 0;
+long mem_num_allocations = 0;
+long mem_num_frees = 0;
+
+// Initialize the heap over [start, start + size)
+void heap_init(void* start, long size) {
+    heap_ptr = (char*)start;
+    heap_end = heap_ptr + size;
+    
+    // Global variables are automatically zeroed, but be explicit
+    mem_total_allocated = 0;
+    mem_total_freed = 0;
+    mem_current_usage = 0;
+    mem_peak_usage = 0;
+    mem_num_allocations = 0;
+    mem_num_frees = 0;
+}
+
+// Simple malloc implementation (bump allocator)
+void* malloc(long size) {
+    if (size <= 0 || size > heap_end - heap_ptr) {
+        return 0;  // NULL - out of memory
+    }
+    
+    void* ptr = (void*)heap_ptr;
+    heap_ptr += size;
+    
+    mem_total_allocated += size;
+    mem_current_usage += size;
+    mem_num_allocations++;
+    
+    if (mem_current_usage > mem_peak_usage) {
+        mem_peak_usage = mem_current_usage;
+    }
+    
+    return ptr;
+}
+
+// Realloc - allocate new block and copy data
+// Note: With bump allocator, we don't track original sizes, so we can't copy properly
+// This is a stub that allocates new memory but doesn't copy old data
+void* realloc(void* ptr, long size) {
+    if (ptr == 0) {
+        return malloc(size);  // If ptr is NULL, behave like malloc
+    }
+    
+    if (size == 0) {
+        // Note: bump allocator can't truly free, but we track the attempt
+        free(ptr);
+        return 0;
+    }
+    
+    // Allocate new block (we don't have original size info with bump allocator)
+    void* new_ptr = malloc(size);
+    
+    // WARNING: We cannot copy data because we don't track original block sizes
+    // This is a fundamental limitation of the bump allocator
+    // A real implementation would use a proper malloc with metadata
+    
+    return new_ptr;
+}
+
+// Free - in bump allocator we can't truly free, but we track it
+// With a proper allocator, we would decrement mem_current_usage
+void free(void* ptr) {
+    if (ptr == 0) return;
+    
+    // With a simple bump allocator, we can't actually free memory
+    // In a real implementation with malloc metadata, we would:
+    //   1. Find the block size from metadata
+    //   2. Decrement mem_current_usage by block size
+    //   3. Increment mem_total_freed by block size
+    //   4. Add the block back to a free list
+    
+    // For now, just track the attempt
+    mem_num_frees++;
+}
+
+// Get remaining heap space
+long heap_available(void) {
+    return (long)(heap_end - heap_ptr);
+}
+
+// Parse command line into argv
+int parse_args(char* line, char** argv, int max_args) {
+    int argc = 0;
+    char* p = line;
+    
+    while (*p && argc < max_args) {
+        // Skip whitespace
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        
+        // Found start of argument
+        argv[argc++] = p;
+        
+        // Find end of argument
+        while (*p && *p != ' ' && *p != '\t') p++;
+        if (*p) *p++ = '\0';
+    }
+    
+    return argc;
+}
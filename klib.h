@@ -0,0 +1,56 @@
+// klib.h - Portable kernel library (klib.c), shared by the kernel and the
+// host-side tests
+#ifndef KLIB_H
+#define KLIB_H
+
+// Strings
+long strlen(const char* str);
+int strcmp(const char* s1, const char* s2);
+int strncmp(const char* s1, const char* s2, long n);
+void strcpy(char* dst, const char* src);
+void strncpy(char* dst, const char* src, long n);
+
+// Character classification and conversion
+int isdigit(int c);
+int isalpha(int c);
+int isalnum(int c);
+int isspace(int c);
+int isupper(int c);
+int islower(int c);
+int toupper(int c);
+int tolower(int c);
+
+// Memory
+void memset(void* ptr, int value, long size);
+void* memcpy(void* dst, const void* src, long size);
+
+// Formatting (%d %x %s %c %% and \n \r \t \\ escapes, up to 6 arguments)
+void int_to_str(long num, char* str, int base);
+void simple_sprintf(char* buf, int buf_size, const char* fmt, long arg1, long arg2, long arg3,
+                    long arg4, long arg5, long arg6);
+
+// Keyboard input buffer
+#define INPUT_BUFFER_SIZE 256
+void input_buffer_put(char c);
+int input_buffer_get(void);     // -1 when empty
+int input_buffer_empty(void);
+void keyboard_handler(int keycode);
+
+// Heap (bump allocator)
+extern long mem_total_allocated;
+extern long mem_total_freed;
+extern long mem_current_usage;
+extern long mem_peak_usage;
+extern long mem_num_allocations;
+extern long mem_num_frees;
+
+void heap_init(void* start, long size);
+void* malloc(long size);
+void* realloc(void* ptr, long size);
+void free(void* ptr);
+long heap_available(void);
+
+// Split a command line into argv in place; returns argc
+int parse_args(char* line, char** argv, int max_args);
+
+#endif // KLIB_H
@@ -0,0 +1,175 @@
+// mkfs.c - Build a VibeOS filesystem image on the host
+//
+// Usage: mkfs <image> <size_mb> [file...]
+//
+// Creates a fresh image and packs the given host files into its root
+// directory, each as a single contiguous extent.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vibefs.h"
+
+#define BS VIBEFS_BLOCK_SIZE
+#define INODE_COUNT 1024
+
+static unsigned char* image;
+static struct vibefs_super* sb;
+static uint32_t next_block;  // Next free data block
+static uint32_t next_ino = VIBEFS_ROOT_INO;
+
+static unsigned char* block_ptr(uint32_t b) {
+    return image + (size_t)b * BS;
+}
+
+static void mark_used(uint32_t b) {
+    unsigned char* bitmap = block_ptr(sb->bitmap_start);
+    bitmap[b / 8] |= 1 << (b % 8);
+}
+
+static struct vibefs_inode* inode_ptr(uint32_t ino) {
+    return (struct vibefs_inode*)block_ptr(sb->inode_start) + ino;
+}
+
+// Allocate `count` contiguous blocks; returns the first one
+static uint32_t alloc_blocks(uint32_t count) {
+    if (next_block + count > sb->block_count) {
+        fprintf(stderr, "mkfs: image full\n");
+        exit(1);
+    }
+    uint32_t start = next_block;
+    for (uint32_t i = 0; i < count; i++) mark_used(start + i);
+    next_block += count;
+    return start;
+}
+
+static uint32_t alloc_inode(uint16_t type, uint64_t size, uint32_t nblocks) {
+    if (next_ino >= sb->inode_count) {
+        fprintf(stderr, "mkfs: out of inodes\n");
+        exit(1);
+    }
+    uint32_t ino = next_ino++;
+    struct vibefs_inode* ip = inode_ptr(ino);
+    ip->type = type;
+    ip->nlink = 1;
+    ip->size = size;
+    ip->mtime = (uint64_t)time(NULL);
+    if (nblocks) {
+        ip->nextents = 1;
+        ip->ext[0].start = alloc_blocks(nblocks);
+        ip->ext[0].len = nblocks;
+    }
+    return ino;
+}
+
+// Insert a name into the root directory's hash table
+static void dir_add(const char* name, uint32_t ino) {
+    struct vibefs_inode* root = inode_ptr(VIBEFS_ROOT_INO);
+    struct vibefs_dirent* slots = (struct vibefs_dirent*)block_ptr(root->ext[0].start);
+    uint32_t nslots = root->size / sizeof(struct vibefs_dirent);
+    uint32_t hash = vibefs_hash(name);
+
+    for (uint32_t i = 0; i < nslots; i++) {
+        struct vibefs_dirent* de = &slots[(hash + i) % nslots];
+        if (de->state == VIBEFS_DE_USED) {
+            if (strcmp(de->name, name) == 0) {
+                fprintf(stderr, "mkfs: duplicate name '%s'\n", name);
+                exit(1);
+            }
+            continue;
+        }
+        de->ino = ino;
+        de->hash = hash;
+        de->state = VIBEFS_DE_USED;
+        de->name_len = (uint8_t)strlen(name);
+        strcpy(de->name, name);
+        return;
+    }
+    fprintf(stderr, "mkfs: root directory full\n");
+    exit(1);
+}
+
+static void add_file(const char* path) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    if (strlen(name) == 0 || strlen(name) > VIBEFS_NAME_MAX) {
+        fprintf(stderr, "mkfs: bad file name '%s'\n", path);
+        exit(1);
+    }
+
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint32_t nblocks = (uint32_t)((size + BS - 1) / BS);
+    uint32_t ino = alloc_inode(VIBEFS_T_FILE, (uint64_t)size, nblocks);
+    struct vibefs_inode* ip = inode_ptr(ino);
+    if (size > 0 && fread(block_ptr(ip->ext[0].start), 1, size, f) != (size_t)size) {
+        perror(path);
+        exit(1);
+    }
+    fclose(f);
+    dir_add(name, ino);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <image> <size_mb> [file...]\n", argv[0]);
+        return 1;
+    }
+
+    long size_mb = atol(argv[2]);
+    if (size_mb < 1 || size_mb > 4096) {
+        fprintf(stderr, "mkfs: size must be 1-4096 MB\n");
+        return 1;
+    }
+    uint32_t block_count = (uint32_t)(size_mb * 1024 * 1024 / BS);
+    image = calloc(block_count, BS);
+    if (!image) {
+        perror("calloc");
+        return 1;
+    }
+
+    sb = (struct vibefs_super*)block_ptr(0);
+    sb->magic = VIBEFS_MAGIC;
+    sb->version = VIBEFS_VERSION;
+    sb->block_count = block_count;
+    sb->inode_count = INODE_COUNT;
+    sb->bitmap_start = 1;
+    sb->bitmap_blocks = (block_count + VIBEFS_BITS_PER_BLOCK - 1) / VIBEFS_BITS_PER_BLOCK;
+    sb->inode_start = sb->bitmap_start + sb->bitmap_blocks;
+    sb->inode_blocks = (INODE_COUNT + VIBEFS_INODES_PER_BLOCK - 1) / VIBEFS_INODES_PER_BLOCK;
+    sb->data_start = sb->inode_start + sb->inode_blocks;
+    sb->root_ino = VIBEFS_ROOT_INO;
+    if (sb->data_start + VIBEFS_DIR_BLOCKS > block_count) {
+        fprintf(stderr, "mkfs: image too small\n");
+        return 1;
+    }
+
+    // Metadata blocks are always in use
+    for (uint32_t b = 0; b < sb->data_start; b++) mark_used(b);
+    next_block = sb->data_start;
+
+    alloc_inode(VIBEFS_T_DIR, (uint64_t)VIBEFS_DIR_BLOCKS * BS, VIBEFS_DIR_BLOCKS);
+    for (int i = 3; i < argc; i++) add_file(argv[i]);
+
+    FILE* out = fopen(argv[1], "wb");
+    if (!out) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fwrite(image, BS, block_count, out) != block_count) {
+        perror(argv[1]);
+        return 1;
+    }
+    fclose(out);
+
+    printf("mkfs: %s: %u blocks, %u inodes, %d files, %u blocks used\n", argv[1],
+           block_count, INODE_COUNT, argc - 3, next_block);
+    return 0;
+}
@@ -0,0 +1,82 @@
+// mkinitramfs.c - Pack files into a VibeOS boot archive on the host
+//
+// Usage: mkinitramfs <archive> [file...]
+//
+// Files are stored under their base name; see initramfs.h for the layout.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "initramfs.h"
+
+static uint32_t align_up(uint32_t v) {
+    return (v + INITRAMFS_ALIGN - 1) & ~(uint32_t)(INITRAMFS_ALIGN - 1);
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int by_name(const void* a, const void* b) {
+    return strcmp(base_name(*(const char* const*)a), base_name(*(const char* const*)b));
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <archive> [file...]\n", argv[0]);
+        return 1;
+    }
+
+    // The kernel binary-searches the index, so sort it by name
+    int count = argc - 2;
+    char** files = argv + 2;
+    qsort(files, count, sizeof(char*), by_name);
+
+    struct initramfs_entry* index = calloc(count ? count : 1, sizeof(*index));
+    uint32_t offset = align_up(sizeof(struct initramfs_header) + count * sizeof(*index));
+    for (int i = 0; i < count; i++) {
+        const char* name = base_name(files[i]);
+        struct stat st;
+        if (strlen(name) == 0 || strlen(name) > INITRAMFS_NAME_MAX) {
+            fprintf(stderr, "mkinitramfs: bad file name '%s'\n", files[i]);
+            return 1;
+        }
+        if (i > 0 && strcmp(name, index[i - 1].name) == 0) {
+            fprintf(stderr, "mkinitramfs: duplicate name '%s'\n", name);
+            return 1;
+        }
+        if (stat(files[i], &st) != 0) {
+            perror(files[i]);
+            return 1;
+        }
+        strcpy(index[i].name, name);
+        index[i].offset = offset;
+        index[i].size = (uint32_t)st.st_size;
+        index[i].mode = st.st_mode & 0777;
+        offset = align_up(offset + index[i].size);
+    }
+
+    struct initramfs_header hdr = {INITRAMFS_MAGIC, INITRAMFS_VERSION, (uint32_t)count, offset};
+    unsigned char* image = calloc(1, offset);
+    memcpy(image, &hdr, sizeof(hdr));
+    memcpy(image + sizeof(hdr), index, count * sizeof(*index));
+    for (int i = 0; i < count; i++) {
+        FILE* f = fopen(files[i], "rb");
+        if (!f || fread(image + index[i].offset, 1, index[i].size, f) != index[i].size) {
+            perror(files[i]);
+            return 1;
+        }
+        fclose(f);
+    }
+
+    FILE* out = fopen(argv[1], "wb");
+    if (!out || fwrite(image, 1, offset, out) != offset) {
+        perror(argv[1]);
+        return 1;
+    }
+    fclose(out);
+
+    printf("mkinitramfs: %s: %d files, %u bytes\n", argv[1], count, offset);
+    return 0;
+}
@@ -8,6 +8,16 @@
 #define SBI_EXT_CONSOLE_PUTCHAR 0x01
 #define SBI_EXT_CONSOLE_GETCHAR 0x02
 
+// SBI Timer extension ("TIME")
+#define SBI_EXT_TIME 0x54494D45
+
+// SBI Base extension: probing for optional extensions
+#define SBI_EXT_BASE 0x10
+#define SBI_BASE_PROBE_EXT 3
+
+// SBI Debug Console extension ("DBCN"): writes a whole buffer per call
+#define SBI_EXT_DBCN 0x4442434E
+
 // SBI call structure
 struct sbiret {
     long error;
@@ -50,4 +60,22 @@ static inline int sbi_console_getchar(void) {
     return ret.error;
 }
 
+// Nonzero if the SBI implementation provides extension `ext`
+static inline long sbi_probe_extension(long ext) {
+    return sbi_ecall(SBI_EXT_BASE, SBI_BASE_PROBE_EXT, ext, 0, 0, 0, 0, 0).value;
+}
+
+// Debug console write - print up to len bytes from a physical address.
+// Returns the number of bytes written, or -1 on error.
+static inline long sbi_debug_console_write(const char* buf, unsigned long len) {
+    struct sbiret ret = sbi_ecall(SBI_EXT_DBCN, 0, len, (unsigned long)buf, 0, 0, 0, 0);
+    return ret.error ? -1 : ret.value;
+}
+
+// Program the next supervisor timer interrupt (absolute rdtime value).
+// This also clears the pending timer interrupt.
+static inline void sbi_set_timer(unsigned long stime_value) {
+    sbi_ecall(SBI_EXT_TIME, 0, stime_value, 0, 0, 0, 0, 0);
+}
+
 #endif // SBI_H
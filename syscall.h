@@ -0,0 +1,13 @@
+// syscall.h - System call numbers (shared by the kernel and user programs)
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+// Calling convention: number in a7, arguments in a0-a2, result in a0
+#define SYS_FUTEX_WAIT 1   // futex_wait(addr, val): sleep while *addr == val
+#define SYS_FUTEX_WAKE 2   // futex_wake(addr, n): wake up to n sleepers on addr
+#define SYS_CHAN_WAIT  3   // chan_wait(id, producer): sleep while the ring is full/empty
+#define SYS_CHAN_WAKE  4   // chan_wake(id, producer): wake the peer end
+#define SYS_MSG_SEND   5   // msg_send(id, buf, len): copy a message into the kernel queue
+#define SYS_MSG_RECV   6   // msg_recv(id, buf, max): copy the next message out
+
+#endif // SYSCALL_H
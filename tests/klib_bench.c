@@ -0,0 +1,219 @@
+// klib_bench.c - Host microbenchmarks for klib.c
+//
+// Usage: klib_bench [filter]
+//
+// Each benchmark is calibrated to run long enough per sample, warmed up,
+// then sampled BENCH_SAMPLES times. Reported per operation: the median,
+// the minimum, the 90th percentile, and the median absolute deviation as a
+// percentage of the median (run-to-run noise). Units are TSC cycles on
+// x86, counter ticks on arm64, nanoseconds elsewhere.
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "klib_host.h"
+#include "klib.h"
+
+#define BENCH_SAMPLES 31
+#define BENCH_MIN_TICKS 200000  // Calibrate each sample to at least this long
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_UNIT "cycles"
+static inline uint64_t bench_now(void) {
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+}
+#elif defined(__aarch64__)
+#define BENCH_UNIT "ticks"
+static inline uint64_t bench_now(void) {
+    uint64_t t;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+}
+#else
+#define BENCH_UNIT "ns"
+static inline uint64_t bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+// Keep the compiler from optimizing a result (or the memory behind it) away
+static inline void keep(long v) {
+    asm volatile("" : : "r"(v) : "memory");
+}
+
+typedef void (*bench_fn)(long iters);
+
+static uint64_t bench_time(bench_fn fn, long iters) {
+    uint64_t start = bench_now();
+    fn(iters);
+    return bench_now() - start;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_run(const char* name, bench_fn fn, const char* filter) {
+    if (filter && !__builtin_strstr(name, filter)) return;
+
+    long iters = 1;
+    while (bench_time(fn, iters) < BENCH_MIN_TICKS && iters < (1L << 30)) iters *= 2;
+    fn(iters);  // Warm up caches and branch predictors
+
+    double s[BENCH_SAMPLES], dev[BENCH_SAMPLES];
+    for (int i = 0; i < BENCH_SAMPLES; i++) s[i] = (double)bench_time(fn, iters) / iters;
+    qsort(s, BENCH_SAMPLES, sizeof(double), cmp_double);
+    double median = s[BENCH_SAMPLES / 2];
+    for (int i = 0; i < BENCH_SAMPLES; i++) dev[i] = s[i] > median ? s[i] - median : median - s[i];
+    qsort(dev, BENCH_SAMPLES, sizeof(double), cmp_double);
+
+    printf("bench: host %-22s median=%9.2f min=%9.2f p90=%9.2f mad=%5.2f%% %s/op\n", name, median,
+           s[0], s[BENCH_SAMPLES * 9 / 10], median ? 100 * dev[BENCH_SAMPLES / 2] / median : 0,
+           BENCH_UNIT);
+}
+
+// Benchmarks
+
+static char text16[] = "vibe> help sync ";
+static char text256[257];
+static char src4k[4096], dst4k[4096];
+static char heap_area[1 << 24];
+
+static void b_strlen16(long n) {
+    for (long i = 0; i < n; i++) keep(strlen(text16));
+}
+
+static void b_strlen256(long n) {
+    for (long i = 0; i < n; i++) keep(strlen(text256));
+}
+
+static void b_strcmp_cmd(long n) {
+    static char cmd[] = "fsbench";
+    for (long i = 0; i < n; i++) keep(strcmp(cmd, "fsbench"));
+}
+
+static void b_strncpy64(long n) {
+    char dst[65];
+    for (long i = 0; i < n; i++) {
+        strncpy(dst, text256, 64);
+        keep((long)dst);
+    }
+}
+
+static void b_memcpy4k(long n) {
+    for (long i = 0; i < n; i++) {
+        memcpy(dst4k, src4k, sizeof(dst4k));
+        keep((long)dst4k);
+    }
+}
+
+static void b_memset4k(long n) {
+    for (long i = 0; i < n; i++) {
+        memset(dst4k, (int)i, sizeof(dst4k));
+        keep((long)dst4k);
+    }
+}
+
+static void b_int_to_str_dec(long n) {
+    char buf[32];
+    for (long i = 0; i < n; i++) {
+        int_to_str(1234567890L + i, buf, 10);
+        keep((long)buf);
+    }
+}
+
+static void b_int_to_str_hex(long n) {
+    char buf[32];
+    for (long i = 0; i < n; i++) {
+        int_to_str(0x80201000L + i, buf, 16);
+        keep((long)buf);
+    }
+}
+
+static void b_sprintf_line(long n) {
+    char buf[128];
+    for (long i = 0; i < n; i++) {
+        simple_sprintf(buf, sizeof(buf), "bench: blk qd=%d iops=%d kbps=%d irqs=%x\\n", 32, i,
+                       i * 4, 0xbeef, 0, 0);
+        keep((long)buf);
+    }
+}
+
+// Includes copying the line back, since parsing modifies it
+static void b_parse_args(long n) {
+    static const char cmd[] = "write notes.txt hello from the vibe shell";
+    char line[sizeof(cmd)];
+    char* argv[16];
+    for (long i = 0; i < n; i++) {
+        __builtin_memcpy(line, cmd, sizeof(cmd));
+        keep(parse_args(line, argv, 16));
+    }
+}
+
+static void b_input_buffer(long n) {
+    for (long i = 0; i < n; i++) {
+        input_buffer_put((char)i);
+        keep(input_buffer_get());
+    }
+}
+
+static void b_keyboard(long n) {
+    for (long i = 0; i < n; i++) {
+        keyboard_handler(0x1E);  // 'a' down, up
+        keyboard_handler(0x9E);
+        keep(input_buffer_get());
+    }
+}
+
+static void b_malloc64(long n) {
+    for (long i = 0; i < n; i++) {
+        void* p = malloc(64);
+        if (!p) {
+            heap_init(heap_area, sizeof(heap_area));
+            p = malloc(64);
+        }
+        keep((long)p);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : 0;
+
+    // Stay on one CPU so the counter and caches stay consistent
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(sched_getcpu() < 0 ? 0 : sched_getcpu(), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+
+    for (int i = 0; i < 256; i++) text256[i] = 'a' + i % 26;
+    for (int i = 0; i < (int)sizeof(src4k); i++) src4k[i] = (char)i;
+    heap_init(heap_area, sizeof(heap_area));
+
+    bench_run("strlen/16", b_strlen16, filter);
+    bench_run("strlen/256", b_strlen256, filter);
+    bench_run("strcmp/command", b_strcmp_cmd, filter);
+    bench_run("strncpy/64", b_strncpy64, filter);
+    bench_run("memcpy/4096", b_memcpy4k, filter);
+    bench_run("memset/4096", b_memset4k, filter);
+    bench_run("int_to_str/dec", b_int_to_str_dec, filter);
+    bench_run("int_to_str/hex", b_int_to_str_hex, filter);
+    bench_run("simple_sprintf/line", b_sprintf_line, filter);
+    bench_run("parse_args/line", b_parse_args, filter);
+    bench_run("input_buffer/put+get", b_input_buffer, filter);
+    bench_run("keyboard_handler/key", b_keyboard, filter);
+    bench_run("malloc/64", b_malloc64, filter);
+    return 0;
+}
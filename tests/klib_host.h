@@ -0,0 +1,28 @@
+// klib_host.h - Build klib.c on the host without clashing with libc
+//
+// Force-included (-include) when compiling klib.c for the host, and
+// included by the test programs ahead of klib.h: every klib function that
+// shares a name with libc gets a klib_ prefix.
+#ifndef KLIB_HOST_H
+#define KLIB_HOST_H
+
+#define strlen  klib_strlen
+#define strcmp  klib_strcmp
+#define strncmp klib_strncmp
+#define strcpy  klib_strcpy
+#define strncpy klib_strncpy
+#define isdigit klib_isdigit
+#define isalpha klib_isalpha
+#define isalnum klib_isalnum
+#define isspace klib_isspace
+#define isupper klib_isupper
+#define islower klib_islower
+#define toupper klib_toupper
+#define tolower klib_tolower
+#define memset  klib_memset
+#define memcpy  klib_memcpy
+#define malloc  klib_malloc
+#define realloc klib_realloc
+#define free    klib_free
+
+#endif // KLIB_HOST_H
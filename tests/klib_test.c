@@ -0,0 +1,430 @@
+// klib_test.c - Host unit tests and fuzzers for klib.c
+//
+// Usage: klib_test [fuzz_iterations] [seed]
+//
+// Built with AddressSanitizer/UBSan by `make test`. The fuzzers compare
+// simple_sprintf, int_to_str and parse_args against reference models built
+// on libc and check that nothing is written past the end of the buffer.
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// libc's allocator, for exact-size buffers that ASan can check (below this
+// point malloc and free are klib's)
+static void* malloc_host(size_t n) { return malloc(n); }
+static void free_host(void* p) { free(p); }
+
+#include "klib_host.h"
+#include "klib.h"
+
+static int failures;
+static int checks;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+#define CHECK_STR(got, want) do { \
+    checks++; \
+    if (__builtin_strcmp((got), (want)) != 0) { \
+        failures++; \
+        fprintf(stderr, "%s:%d: got \"%s\", want \"%s\"\n", __FILE__, __LINE__, (got), (want)); \
+    } \
+} while (0)
+
+// Deterministic PRNG (xorshift64*) so failures can be replayed from the seed
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static long rng_range(long n) {
+    return (long)(rng() % (uint64_t)n);
+}
+
+// Random long biased towards edge cases
+static long rng_long(void) {
+    switch (rng_range(8)) {
+        case 0: return 0;
+        case 1: return LONG_MIN;
+        case 2: return LONG_MAX;
+        case 3: return -1;
+        case 4: return rng_range(100) - 50;
+        default: return (long)rng();
+    }
+}
+
+// Strings
+
+static void test_strings(void) {
+    char buf[16];
+
+    CHECK(strlen("") == 0);
+    CHECK(strlen("vibe") == 4);
+
+    CHECK(strcmp("abc", "abc") == 0);
+    CHECK(strcmp("abc", "abd") < 0);
+    CHECK(strcmp("abd", "abc") > 0);
+    CHECK(strcmp("ab", "abc") < 0);
+    CHECK(strcmp("\xff", "a") > 0);  // Compares as unsigned char
+
+    CHECK(strncmp("abcx", "abcy", 3) == 0);
+    CHECK(strncmp("abcx", "abcy", 4) < 0);
+    CHECK(strncmp("a", "b", 0) == 0);
+
+    strcpy(buf, "hello");
+    CHECK_STR(buf, "hello");
+
+    // strncpy copies at most n bytes and terminates only if there is room
+    __builtin_memset(buf, 'X', sizeof(buf));
+    strncpy(buf, "abc", 2);
+    CHECK(buf[0] == 'a' && buf[1] == 'b' && buf[2] == 'X');
+    __builtin_memset(buf, 'X', sizeof(buf));
+    strncpy(buf, "ab", 5);
+    CHECK(buf[0] == 'a' && buf[1] == 'b' && buf[2] == 0 && buf[3] == 'X');
+
+    CHECK(isdigit('7') && !isdigit('a'));
+    CHECK(isalpha('q') && isalpha('Q') && !isalpha('1'));
+    CHECK(isalnum('z') && isalnum('0') && !isalnum('-'));
+    CHECK(isspace(' ') && isspace('\t') && !isspace('x'));
+    CHECK(toupper('a') == 'A' && toupper('1') == '1');
+    CHECK(tolower('Z') == 'z' && tolower('z') == 'z');
+
+    __builtin_memset(buf, 0, sizeof(buf));
+    memset(buf, 'v', 4);
+    CHECK_STR(buf, "vvvv");
+    CHECK(memcpy(buf + 4, "ibe", 4) == buf + 4);
+    CHECK_STR(buf, "vvvvibe");
+}
+
+// Formatting
+
+static void test_int_to_str(void) {
+    char buf[32];
+
+    int_to_str(0, buf, 10);
+    CHECK_STR(buf, "0");
+    int_to_str(42, buf, 10);
+    CHECK_STR(buf, "42");
+    int_to_str(-42, buf, 10);
+    CHECK_STR(buf, "-42");
+    int_to_str(LONG_MIN, buf, 10);
+    CHECK_STR(buf, "-9223372036854775808");
+    int_to_str(255, buf, 16);
+    CHECK_STR(buf, "ff");
+    int_to_str(-1, buf, 16);  // Hex shows the two's complement bits
+    CHECK_STR(buf, "ffffffffffffffff");
+}
+
+static void test_sprintf(void) {
+    char buf[64];
+
+    simple_sprintf(buf, sizeof(buf), "pid %d at %x: %s%c", 7, 0xbeef, (long)"ok", '!', 0, 0);
+    CHECK_STR(buf, "pid 7 at beef: ok!");
+    simple_sprintf(buf, sizeof(buf), "100%% %q", 0, 0, 0, 0, 0, 0);
+    CHECK_STR(buf, "100% %q");
+    simple_sprintf(buf, sizeof(buf), "a\\tb\\n", 0, 0, 0, 0, 0, 0);
+    CHECK_STR(buf, "a\tb\n");
+    simple_sprintf(buf, sizeof(buf), "%s|", 0, 0, 0, 0, 0, 0);  // NULL prints nothing
+    CHECK_STR(buf, "|");
+    simple_sprintf(buf, sizeof(buf), "%d%d%d%d%d%d%d", 1, 2, 3, 4, 5, 6);  // Only 6 args
+    CHECK_STR(buf, "123456");
+    simple_sprintf(buf, 5, "%d", 123456789, 0, 0, 0, 0, 0);  // Truncated
+    CHECK_STR(buf, "1234");
+    simple_sprintf(buf, 1, "abc", 0, 0, 0, 0, 0, 0);
+    CHECK_STR(buf, "");
+    simple_sprintf(buf, sizeof(buf), "end%", 0, 0, 0, 0, 0, 0);  // Trailing '%'
+    CHECK_STR(buf, "end%");
+}
+
+// Reference model of simple_sprintf built on libc; returns the untruncated length
+static int ref_sprintf(char* out, const char* fmt, const long* args) {
+    int n = 0;
+    int ai = 0;
+    for (const char* f = fmt; *f; f++) {
+        if (f[0] == '%' && f[1]) {
+            f++;
+            switch (*f) {
+                case 'd':
+                    if (ai < 6) n += sprintf(out + n, "%ld", args[ai++]);
+                    break;
+                case 'x':
+                    if (ai < 6) n += sprintf(out + n, "%lx", (unsigned long)args[ai++]);
+                    break;
+                case 's':
+                    if (ai < 6 && args[ai]) n += sprintf(out + n, "%s", (const char*)args[ai]);
+                    if (ai < 6) ai++;
+                    break;
+                case 'c':
+                    if (ai < 6) out[n++] = (char)args[ai++];
+                    break;
+                case '%':
+                    out[n++] = '%';
+                    break;
+                default:
+                    out[n++] = '%';
+                    out[n++] = *f;
+                    break;
+            }
+        } else if (f[0] == '\\' && f[1]) {
+            f++;
+            switch (*f) {
+                case 'n': out[n++] = '\n'; break;
+                case 'r': out[n++] = '\r'; break;
+                case 't': out[n++] = '\t'; break;
+                case '\\': out[n++] = '\\'; break;
+                default:
+                    out[n++] = '\\';
+                    out[n++] = *f;
+                    break;
+            }
+        } else {
+            out[n++] = *f;
+        }
+    }
+    return n;
+}
+
+static const char* fuzz_strings[] = {"", "a", "hello world", "%d", "\\n",
+                                     "a much longer string that fills buffers quickly"};
+
+static void fuzz_sprintf(long iters) {
+    static const char* pieces[] = {"%d", "%x", "%s", "%c", "%%", "%", "%z", "\\n", "\\t",
+                                   "\\\\", "\\q", "\\", "x", "hello ", " "};
+    const int npieces = sizeof(pieces) / sizeof(pieces[0]);
+    const int nstrings = sizeof(fuzz_strings) / sizeof(fuzz_strings[0]);
+
+    for (long it = 0; it < iters; it++) {
+        char fmt[128];
+        int flen = 0;
+        int count = (int)rng_range(12);
+        for (int i = 0; i < count; i++) {
+            const char* p = pieces[rng_range(npieces)];
+            while (*p && flen < (int)sizeof(fmt) - 1) fmt[flen++] = *p++;
+        }
+        fmt[flen] = 0;
+
+        // Numbers for every conversion except %s, which gets a string or NULL
+        long args[6];
+        for (int i = 0; i < 6; i++) args[i] = rng_long();
+        int ai = 0;
+        for (const char* f = fmt; *f && ai < 6; f++) {
+            if (f[0] == '%' && f[1]) {
+                f++;
+                if (*f == 's') args[ai] = rng_range(4) ? (long)fuzz_strings[rng_range(nstrings)] : 0;
+                if (*f == 'd' || *f == 'x' || *f == 's' || *f == 'c') ai++;
+            } else if (f[0] == '\\' && f[1]) {
+                f++;
+            }
+        }
+
+        char want[2048];
+        int want_len = ref_sprintf(want, fmt, args);
+
+        int size = 1 + (int)rng_range(80);
+        char* buf = malloc_host(size);
+        simple_sprintf(buf, size, fmt, args[0], args[1], args[2], args[3], args[4], args[5]);
+        int len = want_len < size - 1 ? want_len : size - 1;
+        checks++;
+        if (__builtin_memcmp(buf, want, len) != 0 || buf[len] != 0) {
+            failures++;
+            fprintf(stderr, "fuzz_sprintf: fmt \"%s\" size %d: got \"%s\", want \"%.*s\"\n",
+                    fmt, size, buf, len, want);
+        }
+        free_host(buf);
+    }
+}
+
+static void fuzz_int_to_str(long iters) {
+    for (long it = 0; it < iters; it++) {
+        long v = rng_long();
+        char got[32], want[32];
+        int_to_str(v, got, 10);
+        sprintf(want, "%ld", v);
+        CHECK_STR(got, want);
+        int_to_str(v, got, 16);
+        sprintf(want, "%lx", (unsigned long)v);
+        CHECK_STR(got, want);
+    }
+}
+
+// Keyboard input
+
+static void drain_input(void) {
+    while (input_buffer_get() != -1) {
+    }
+}
+
+static void test_input_buffer(void) {
+    drain_input();
+    CHECK(input_buffer_empty());
+    CHECK(input_buffer_get() == -1);
+
+    input_buffer_put('a');
+    input_buffer_put((char)0xff);  // High bytes come back as 0-255, not EOF
+    CHECK(!input_buffer_empty());
+    CHECK(input_buffer_get() == 'a');
+    CHECK(input_buffer_get() == 0xff);
+    CHECK(input_buffer_get() == -1);
+
+    // Fills up at INPUT_BUFFER_SIZE and drops the rest; order survives wrap-around
+    for (int i = 0; i < INPUT_BUFFER_SIZE + 10; i++) input_buffer_put((char)(i & 0x7f));
+    int ok = 1;
+    for (int i = 0; i < INPUT_BUFFER_SIZE; i++) ok &= input_buffer_get() == (i & 0x7f);
+    CHECK(ok);
+    CHECK(input_buffer_get() == -1);
+}
+
+static void test_keyboard(void) {
+    drain_input();
+    keyboard_handler(0x1E);         // 'a' pressed
+    keyboard_handler(0x9E);         // and released: no character
+    CHECK(input_buffer_get() == 'a');
+    CHECK(input_buffer_get() == -1);
+
+    keyboard_handler(0x2A);         // Shift down
+    keyboard_handler(0x1E);
+    keyboard_handler(0x02);         // '1' -> '!'
+    keyboard_handler(0xAA);         // Shift up
+    keyboard_handler(0x1E);
+    CHECK(input_buffer_get() == 'A');
+    CHECK(input_buffer_get() == '!');
+    CHECK(input_buffer_get() == 'a');
+
+    keyboard_handler(0x1D);         // Ctrl down
+    keyboard_handler(0x2E);         // Ctrl+C
+    keyboard_handler(0x53);         // Ctrl+Delete -> EOF
+    keyboard_handler(0x9D);         // Ctrl up
+    keyboard_handler(0x53);         // Delete alone: nothing
+    keyboard_handler(0x1C);         // Enter
+    CHECK(input_buffer_get() == 3);
+    CHECK(input_buffer_get() == 4);
+    CHECK(input_buffer_get() == 13);
+    CHECK(input_buffer_get() == -1);
+
+    keyboard_handler(0x3B);         // F1 has no mapping
+    CHECK(input_buffer_empty());
+}
+
+// Heap
+
+static void test_heap(void) {
+    static char heap[1024];
+    heap_init(heap, sizeof(heap));
+
+    CHECK(malloc(0) == 0);
+    CHECK(malloc(-1) == 0);
+    CHECK(malloc(LONG_MAX) == 0);
+    char* a = malloc(1000);
+    CHECK(a == heap);
+    CHECK(heap_available() == 24);
+    CHECK(malloc(25) == 0);
+    char* b = malloc(24);
+    CHECK(b == heap + 1000);
+    CHECK(heap_available() == 0);
+    CHECK(mem_num_allocations == 2);
+    CHECK(mem_total_allocated == 1024);
+    CHECK(mem_peak_usage == 1024);
+
+    free(a);
+    free(0);
+    CHECK(mem_num_frees == 1);
+
+    heap_init(heap, sizeof(heap));
+    char* c = realloc(0, 16);
+    CHECK(c == heap);
+    CHECK(realloc(c, 0) == 0);
+    CHECK(realloc(c, 32) == heap + 16);
+    CHECK(mem_num_allocations == 2 && mem_num_frees == 1);
+}
+
+// Argument parsing
+
+static void test_parse_args(void) {
+    char line[64];
+    char* argv[4];
+
+    __builtin_strcpy(line, "  cp\ta.txt   b.txt ");
+    CHECK(parse_args(line, argv, 4) == 3);
+    CHECK_STR(argv[0], "cp");
+    CHECK_STR(argv[1], "a.txt");
+    CHECK_STR(argv[2], "b.txt");
+
+    __builtin_strcpy(line, "");
+    CHECK(parse_args(line, argv, 4) == 0);
+    __builtin_strcpy(line, " \t ");
+    CHECK(parse_args(line, argv, 4) == 0);
+
+    __builtin_strcpy(line, "a b c d e f");
+    CHECK(parse_args(line, argv, 4) == 4);
+    CHECK_STR(argv[3], "d");
+}
+
+static void fuzz_parse_args(long iters) {
+    static const char alphabet[] = "  \t\tab\"'\\-\n";
+
+    for (long it = 0; it < iters; it++) {
+        char line[64], copy[64];
+        int len = (int)rng_range(sizeof(line));
+        for (int i = 0; i < len; i++) line[i] = alphabet[rng_range(sizeof(alphabet) - 1)];
+        line[len] = 0;
+        __builtin_memcpy(copy, line, len + 1);
+
+        int max_args = 1 + (int)rng_range(8);
+        char* argv[8];
+        int argc = parse_args(line, argv, max_args);
+
+        // Reference: the first max_args runs of non-blank characters
+        int want = 0;
+        int ok = argc >= 0 && argc <= max_args;
+        for (int i = 0; i < len && ok;) {
+            if (copy[i] == ' ' || copy[i] == '\t') {
+                i++;
+                continue;
+            }
+            int start = i;
+            while (i < len && copy[i] != ' ' && copy[i] != '\t') i++;
+            if (want == max_args) break;
+            ok = want < argc && argv[want] == line + start &&
+                 (int)__builtin_strlen(argv[want]) == i - start &&
+                 __builtin_memcmp(argv[want], copy + start, i - start) == 0;
+            want++;
+        }
+        checks++;
+        if (!ok || argc != want) {
+            failures++;
+            fprintf(stderr, "fuzz_parse_args: \"%s\" max %d: argc %d, want %d\n", copy, max_args,
+                    argc, want);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    long iters = argc > 1 ? atol(argv[1]) : 100000;
+    if (argc > 2) rng_state = strtoull(argv[2], 0, 0) | 1;
+    printf("klib_test: seed %#llx, %ld fuzz iterations\n", (unsigned long long)rng_state, iters);
+
+    test_strings();
+    test_int_to_str();
+    test_sprintf();
+    test_input_buffer();
+    test_keyboard();
+    test_heap();
+    test_parse_args();
+
+    fuzz_int_to_str(iters);
+    fuzz_sprintf(iters);
+    fuzz_parse_args(iters);
+
+    printf("klib_test: %d checks, %d failures\n", checks, failures);
+    return failures ? 1 : 0;
+}
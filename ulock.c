@@ -0,0 +1,73 @@
+// ulock.c - Futex-based mutex and condition variable (see ulock.h)
+//
+// The mutex is the classic three-state futex lock: lock is one CAS from
+// UNLOCKED to LOCKED; a thread that finds it held marks it CONTENDED and
+// sleeps, and unlock only calls futex_wake when the old state was
+// CONTENDED.
+#include "ulock.h"
+
+static inline uint32_t swap(volatile uint32_t* p, uint32_t v) {
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQUIRE);
+}
+
+void umutex_init(umutex_t* m) {
+    m->state = UMUTEX_UNLOCKED;
+}
+
+int umutex_trylock(umutex_t* m) {
+    uint32_t c = UMUTEX_UNLOCKED;
+    return __atomic_compare_exchange_n(&m->state, &c, UMUTEX_LOCKED, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// Sleep until the mutex is ours. We take it as CONTENDED, since we can't
+// tell whether other threads are still waiting behind us.
+static void umutex_lock_slow(umutex_t* m, uint32_t c) {
+    if (c != UMUTEX_CONTENDED) c = swap(&m->state, UMUTEX_CONTENDED);
+    while (c != UMUTEX_UNLOCKED) {
+        futex_wait(&m->state, UMUTEX_CONTENDED);
+        c = swap(&m->state, UMUTEX_CONTENDED);
+    }
+}
+
+void umutex_lock(umutex_t* m) {
+    uint32_t c = UMUTEX_UNLOCKED;
+    if (__atomic_compare_exchange_n(&m->state, &c, UMUTEX_LOCKED, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    umutex_lock_slow(m, c);
+}
+
+void umutex_unlock(umutex_t* m) {
+    if (__atomic_exchange_n(&m->state, UMUTEX_UNLOCKED, __ATOMIC_RELEASE) == UMUTEX_CONTENDED) {
+        futex_wake(&m->state, 1);
+    }
+}
+
+void ucond_init(ucond_t* c) {
+    c->seq = 0;
+    c->waiters = 0;
+}
+
+// Atomically release m and sleep until signalled; m is held again on return.
+// Wakeups can be spurious, so callers re-check their condition in a loop.
+void ucond_wait(ucond_t* c, umutex_t* m) {
+    uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->waiters, 1, __ATOMIC_RELAXED);
+    umutex_unlock(m);
+    // Returns at once if a signal bumped seq after we read it
+    futex_wait(&c->seq, seq);
+    __atomic_fetch_sub(&c->waiters, 1, __ATOMIC_RELAXED);
+    umutex_lock_slow(m, UMUTEX_LOCKED);
+}
+
+void ucond_signal(ucond_t* c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&c->waiters, __ATOMIC_RELAXED)) futex_wake(&c->seq, 1);
+}
+
+void ucond_broadcast(ucond_t* c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&c->waiters, __ATOMIC_RELAXED)) futex_wake(&c->seq, 0x7fffffff);
+}
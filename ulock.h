@@ -0,0 +1,64 @@
+// ulock.h - Mutex and condition variable built on futexes
+//
+// The lock word lives in memory shared by the threads using it and is
+// updated with atomic CAS/swap (A extension), so an uncontended lock or
+// unlock never enters the kernel. Only a thread that has to wait, or an
+// unlock/signal that finds waiters, makes a futex call.
+#ifndef ULOCK_H
+#define ULOCK_H
+
+#include <stdint.h>
+#include "syscall.h"
+
+// Mutex states
+#define UMUTEX_UNLOCKED  0
+#define UMUTEX_LOCKED    1   // Held, nobody waiting
+#define UMUTEX_CONTENDED 2   // Held, and there may be waiters
+
+typedef struct {
+    volatile uint32_t state;
+} umutex_t;
+
+typedef struct {
+    volatile uint32_t seq;      // Bumped by every signal/broadcast
+    volatile uint32_t waiters;  // Threads in ucond_wait
+} ucond_t;
+
+#define UMUTEX_INIT {UMUTEX_UNLOCKED}
+#define UCOND_INIT {0, 0}
+
+#ifdef ULOCK_USER
+// User programs reach the kernel through ecall. Nothing runs in U-mode yet,
+// so this variant is untested; mtxbench measures the direct-call one.
+static inline long futex_syscall(long nr, volatile uint32_t* addr, long arg) {
+    register long a0 asm("a0") = (long)addr;
+    register long a1 asm("a1") = arg;
+    register long a7 asm("a7") = nr;
+    asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a7) : "memory");
+    return a0;
+}
+
+static inline long futex_wait(volatile uint32_t* addr, uint32_t val) {
+    return futex_syscall(SYS_FUTEX_WAIT, addr, val);
+}
+
+static inline long futex_wake(volatile uint32_t* addr, int n) {
+    return futex_syscall(SYS_FUTEX_WAKE, addr, n);
+}
+#else
+// Kernel threads call the kernel's implementation directly (kernel.c)
+long futex_wait(volatile uint32_t* addr, uint32_t val);
+long futex_wake(volatile uint32_t* addr, int n);
+#endif
+
+void umutex_init(umutex_t* m);
+void umutex_lock(umutex_t* m);
+int umutex_trylock(umutex_t* m);   // 1 if acquired
+void umutex_unlock(umutex_t* m);
+
+void ucond_init(ucond_t* c);
+void ucond_wait(ucond_t* c, umutex_t* m);
+void ucond_signal(ucond_t* c);
+void ucond_broadcast(ucond_t* c);
+
+#endif // ULOCK_H
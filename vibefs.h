@@ -0,0 +1,85 @@
+// vibefs.h - On-disk format of the VibeOS filesystem (shared by kernel and mkfs)
+#ifndef VIBEFS_H
+#define VIBEFS_H
+
+#include <stdint.h>
+
+// Disk layout, in 4KB blocks:
+//   0                 superblock
+//   bitmap_start      block bitmap (1 bit per block, 1 = used)
+//   inode_start       inode table
+//   data_start        file and directory data
+//
+// Files are described by extents (runs of contiguous blocks) rather than
+// per-block pointers. The root directory is a fixed-size hash table of
+// directory entries, probed linearly from hash(name) % slots.
+
+#define VIBEFS_MAGIC       0x45424956  // "VIBE"
+#define VIBEFS_VERSION     1
+#define VIBEFS_BLOCK_SIZE  4096
+#define VIBEFS_ROOT_INO    1           // Inode 0 is never used
+#define VIBEFS_NEXTENTS    12          // Extents per inode
+#define VIBEFS_NAME_MAX    53          // Name bytes, excluding the terminator
+#define VIBEFS_DIR_BLOCKS  16          // Root directory size (1024 entries)
+
+// Inode types
+#define VIBEFS_T_FREE 0
+#define VIBEFS_T_FILE 1
+#define VIBEFS_T_DIR  2
+
+// Directory entry states
+#define VIBEFS_DE_EMPTY   0            // Never used: ends a probe sequence
+#define VIBEFS_DE_USED    1
+#define VIBEFS_DE_DELETED 2            // Tombstone: probing continues past it
+
+struct vibefs_super {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_count;      // Total blocks on the disk
+    uint32_t inode_count;
+    uint32_t bitmap_start;
+    uint32_t bitmap_blocks;
+    uint32_t inode_start;
+    uint32_t inode_blocks;
+    uint32_t data_start;
+    uint32_t root_ino;
+};
+
+struct vibefs_extent {
+    uint32_t start;            // First block
+    uint32_t len;              // Blocks in the run
+};
+
+struct vibefs_inode {
+    uint16_t type;             // VIBEFS_T_*
+    uint16_t nlink;
+    uint32_t nextents;         // Extents in use
+    uint64_t size;             // Bytes
+    uint64_t mtime;            // Seconds since the epoch
+    struct vibefs_extent ext[VIBEFS_NEXTENTS];
+    uint32_t reserved[2];
+};
+
+struct vibefs_dirent {
+    uint32_t ino;
+    uint32_t hash;             // vibefs_hash(name)
+    uint8_t state;             // VIBEFS_DE_*
+    uint8_t name_len;
+    char name[VIBEFS_NAME_MAX + 1];
+};
+
+#define VIBEFS_INODES_PER_BLOCK  (VIBEFS_BLOCK_SIZE / sizeof(struct vibefs_inode))
+#define VIBEFS_DIRENTS_PER_BLOCK (VIBEFS_BLOCK_SIZE / sizeof(struct vibefs_dirent))
+#define VIBEFS_BITS_PER_BLOCK    (VIBEFS_BLOCK_SIZE * 8)
+
+// FNV-1a hash of a file name
+static inline uint32_t vibefs_hash(const char* name) {
+    uint32_t h = 2166136261U;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+#endif // VIBEFS_H
@@ -0,0 +1,114 @@
+// virtio.h - virtio-mmio transport and virtio-blk definitions
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+
+// QEMU virt machine: 8 virtio-mmio slots, 0x1000 apart, on PLIC IRQs 1..8
+#define VIRTIO_MMIO_BASE   0x10001000
+#define VIRTIO_MMIO_STRIDE 0x1000
+#define VIRTIO_MMIO_SLOTS  8
+#define VIRTIO_MMIO_IRQ(slot) (1 + (slot))
+
+// virtio-mmio register offsets (virtio spec 4.2.2)
+#define VIRTIO_MMIO_MAGIC_VALUE         0x000  // "virt" = 0x74726976
+#define VIRTIO_MMIO_VERSION             0x004  // 2 = modern, 1 = legacy
+#define VIRTIO_MMIO_DEVICE_ID           0x008  // 0 = empty slot, 2 = block
+#define VIRTIO_MMIO_VENDOR_ID           0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES     0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES     0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL           0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_MMIO_QUEUE_NUM           0x038
+#define VIRTIO_MMIO_QUEUE_READY         0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK       0x064
+#define VIRTIO_MMIO_STATUS              0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW    0x090  // Available ring
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH   0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW    0x0a0  // Used ring
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH   0x0a4
+#define VIRTIO_MMIO_CONFIG              0x100  // Device-specific config space
+
+#define VIRTIO_MAGIC        0x74726976
+#define VIRTIO_DEV_BLK      2
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER      2
+#define VIRTIO_STATUS_DRIVER_OK   4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED      128
+
+// Feature bits
+#define VIRTIO_BLK_F_SEG_MAX      2   // Config seg_max is valid
+#define VIRTIO_BLK_F_RO           5   // Device is read-only
+#define VIRTIO_BLK_F_FLUSH        9   // Flush command supported
+#define VIRTIO_RING_F_EVENT_IDX   29  // used_event/avail_event notification suppression
+#define VIRTIO_F_VERSION_1        32  // Modern (non-legacy) device
+
+// Split virtqueue descriptor
+#define VRING_DESC_F_NEXT  1
+#define VRING_DESC_F_WRITE 2  // Device writes (vs reads) this buffer
+
+// Used ring flag: device doesn't want notifications (only without EVENT_IDX)
+#define VRING_USED_F_NO_NOTIFY 1
+
+struct vring_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+// Available ring; used_event follows ring[num] when EVENT_IDX is negotiated
+struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+};
+
+struct vring_used_elem {
+    uint32_t id;   // Head descriptor of the completed chain
+    uint32_t len;  // Bytes written by the device
+};
+
+// Used ring; avail_event follows ring[num] when EVENT_IDX is negotiated
+struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem ring[];
+};
+
+// True if moving the index from old to new_idx crossed the peer's event index
+static inline int vring_need_event(uint16_t event, uint16_t new_idx, uint16_t old) {
+    return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old);
+}
+
+// virtio-blk request header (device reads) and status values
+#define VIRTIO_BLK_T_IN    0  // Read
+#define VIRTIO_BLK_T_OUT   1  // Write
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_BLK_S_OK     0
+#define VIRTIO_BLK_S_IOERR  1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+struct virtio_blk_outhdr {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+
+// virtio-blk config space offsets
+#define VIRTIO_BLK_CFG_CAPACITY 0x00  // 64-bit, in 512-byte sectors
+#define VIRTIO_BLK_CFG_SEG_MAX  0x0c
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+#endif // VIRTIO_H